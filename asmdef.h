@@ -10,6 +10,13 @@
 // offset, buffer, length
 #define BCM2_READ_FUNC_OBL		(1 << 1)
 
+// rwcode: print base64 lines, with a crc16 per line
+#define BCM2_READ_FMT_BASE64	(1 << 24)
+// rwcode: print runs of identical words as *count:word
+#define BCM2_READ_FMT_RLE		(1 << 25)
+// rwcode: print the crc32 of each chunk, instead of its contents
+#define BCM2_READ_FMT_CRC32		(1 << 26)
+
 // offset, length
 #define BCM2_ERASE_FUNC_OL		(1 << 8)
 // offset, partition size
@@ -17,12 +17,22 @@
  *
  */
 
+#include <condition_variable>
 #include <stdexcept>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <future>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <list>
+#include <set>
 #include <unistd.h>
+#include <getopt.h>
 #include "interface.h"
 #include "progress.h"
+#include "session.h"
 #include "rwx.h"
 #include "io.h"
 using namespace std;
@@ -32,12 +42,16 @@ using namespace bcm2dump;
 #define VERSION "v(unknown)"
 #endif
 
+int do_main(int argc, char** argv);
+
 namespace {
 
 const unsigned opt_resume = 1;
 const unsigned opt_force = (1 << 1);
 const unsigned opt_safe = (1 << 2);
 const unsigned opt_force_write = (1 << 3);
+// values returned by getopt_long() for options without a short form
+const int opt_long_stats = 0x100;
 
 void usage(bool help = false)
 {
@@ -48,9 +62,13 @@ void usage(bool help = false)
 	os << "Options:" << endl;
 	os << "  -s               Always use safe (and slow) methods" << endl;
 	os << "  -R               Resume dump" << endl;
+	os << "  -D <filename>    Delta dump, based on a previous dump" << endl;
+	os << "  -j <sessions>    Dump using multiple connections (e.g. telnet)" << endl;
 	os << "  -F               Force operation" << endl;
 	os << "  -P <profile>     Force profile" << endl;
 	os << "  -L <filename>    I/O log file" << endl;
+	os << "  -T <filename>    Record I/O trace, for use with replay:" << endl;
+	os << "  --stats <file>   Write dump statistics to file (JSON)" << endl;
 	os << "  -O <opt>=<val>   Override option value" << endl;
 	os << "  -q               Decrease verbosity" << endl;
 	os << "  -v               Increase verbosity" << endl;
@@ -60,7 +78,8 @@ void usage(bool help = false)
 	if (help) {
 		os << "\n    Dump data from given address space, starting at an explicit offset\n"
 				"    or alternately a partition name. If a partition name is used, the\n"
-				"    <size> argument may be omitted. Data is stored in file <out>.\n\n";
+				"    <size> argument may be omitted. Data is stored in file <out>.\n"
+				"    With -D, only blocks that differ from the previous dump are read.\n\n";
 	}
 	os << "  scan  <interface> <addrspace> <step> [<start> <size>]" << endl;
 	if (help) {
@@ -95,6 +114,20 @@ void usage(bool help = false)
 		os << "\n    Print information about a profile. In the absence of a -P flag, use\n"
 				"    auto-detection.\n\n";
 	}
+	os << "  batch <jobfile> [<threads> [<retries>]]" << endl;
+	if (help) {
+		os << "\n    Run the dumps listed in <jobfile>, one per line, in the form\n"
+				"    <interface> <addrspace> <range> <out>. Up to <threads> (default 4)\n"
+				"    jobs on different interfaces run at the same time. Failed jobs are\n"
+				"    resumed up to <retries> (default 2) times.\n\n";
+	}
+	os << "  serve <interface> <socket>" << endl;
+	if (help) {
+		os << "\n    Open the interface and keep it open, serving commands that use\n"
+				"    session:<socket> as their interface. Detection, privilege elevation\n"
+				"    and code uploads are done only once. Options that affect the\n"
+				"    interface (-P, -T) must be passed to this command.\n\n";
+	}
 	os << "  help" << endl;
 	if (help) {
 		os << "\n    Print this information and exit.\n";
@@ -115,6 +148,8 @@ void usage(bool help = false)
 #ifdef BCM2DUMP_WITH_SNMP
 	os << "  snmp:192.168.100.1       SNMP interface at 192.168.100.1" << endl;
 #endif
+	os << "  session:/tmp/bcm2.sock   Session opened by the serve command" << endl;
+	os << "  replay:trace.bin,2       Replay I/O trace at 2x speed (0: no delays)" << endl;
 	os << endl;
 	os << "Profiles:" << endl;
 	os << get_profile_names(70, 2) << endl;
@@ -149,6 +184,134 @@ void handle_sigint()
 	logger::w() << endl << "interrupted" << endl;
 }
 
+struct
+{
+	string spec;
+	string profile;
+	interface::sp intf;
+	map<pair<string, bool>, rwx::sp> rwxs;
+
+	void reset()
+	{
+		rwxs.clear();
+		intf.reset();
+	}
+} served;
+
+interface::sp create_interface(const string& spec, const string& profile)
+{
+	if (!starts_with(spec, "session:") || served.spec.empty()) {
+		return interface::create(spec, profile);
+	}
+
+	if (!served.intf) {
+		served.intf = interface::create(served.spec, served.profile);
+	}
+
+	return served.intf;
+}
+
+rwx::sp create_rwx(const interface::sp& intf, const string& type, bool safe)
+{
+	if (intf != served.intf) {
+		return rwx::create(intf, type, safe);
+	}
+
+	auto& rwx = served.rwxs[{ type, safe }];
+	if (!rwx) {
+		rwx = rwx::create(intf, type, safe);
+	} else {
+		rwx->set_progress_listener();
+		rwx->set_image_listener();
+	}
+
+	return rwx;
+}
+
+string stats_file;
+
+string json_str(const string& str)
+{
+	string ret = "\"";
+
+	for (char c : str) {
+		if (c == '"' || c == '\\') {
+			ret += '\\';
+			ret += c;
+		} else if (!isprint(c)) {
+			ret += "\\u00" + to_hex(c);
+		} else {
+			ret += c;
+		}
+	}
+
+	return ret + "\"";
+}
+
+void write_stats(const interface::sp& intf, const vector<rwx::sp>& rwxs, const string& space, uint64_t ms)
+{
+	rwx::chunk_stats cs;
+	rwx::pipeline_stats ps;
+
+	for (auto& rwx : rwxs) {
+		auto& s = rwx->get_chunk_stats();
+		cs.latency.add(s.latency);
+		cs.first_byte.add(s.first_byte);
+		cs.parse.add(s.parse);
+		cs.wait_quiet.add(s.wait_quiet);
+		cs.bytes.add(s.bytes);
+		cs.retries.add(s.retries);
+
+		auto& p = rwx->get_pipeline_stats();
+		ps.chunks += p.chunks;
+		ps.max_depth = max(ps.max_depth, p.max_depth);
+		ps.avg_depth += p.avg_depth * p.chunks;
+		ps.stalls += p.stalls;
+	}
+
+	if (ps.chunks) {
+		ps.avg_depth /= ps.chunks;
+	}
+
+	ofstream os(stats_file);
+	if (!os.good()) {
+		throw user_error("failed to open " + stats_file + " for writing");
+	}
+
+	auto hist = [&os] (const char* name, const histogram& h, bool last = false) {
+		os << "    " << json_str(name) << ": ";
+		h.to_json(os);
+		os << (last ? "" : ",") << endl;
+	};
+
+	os << "{" << endl;
+	os << "  \"bcm2dump\": " << json_str(VERSION) << "," << endl;
+	os << "  \"interface\": " << json_str(intf->name()) << "," << endl;
+	os << "  \"profile\": " << json_str(intf->profile() ? intf->profile()->name() : "") << "," << endl;
+	os << "  \"version\": " << json_str(intf->version().name()) << "," << endl;
+	os << "  \"rwx\": " << json_str(rwxs.front()->name()) << "," << endl;
+	os << "  \"space\": " << json_str(space) << "," << endl;
+	os << "  \"sessions\": " << rwxs.size() << "," << endl;
+	os << "  \"elapsed_ms\": " << ms << "," << endl;
+	os << "  \"bytes\": " << cs.bytes.sum() << "," << endl;
+	os << "  \"bytes_per_second\": " << uint64_t(1000.0 * cs.bytes.sum() / max(ms, uint64_t(1))) << "," << endl;
+	os << "  \"chunks\": {" << endl;
+	hist("latency_us", cs.latency);
+	hist("first_byte_us", cs.first_byte);
+	hist("parse_us", cs.parse);
+	hist("wait_quiet_us", cs.wait_quiet);
+	hist("bytes", cs.bytes);
+	hist("retries", cs.retries, true);
+	os << "  }," << endl;
+	os << "  \"interface_stats\": {" << endl;
+	auto cmdline = dynamic_pointer_cast<cmdline_interface>(intf);
+	hist("wait_ready_us", cmdline ? cmdline->wait_ready_stats() : histogram(), true);
+	os << "  }," << endl;
+	os << "  \"writer_queue\": { \"chunks\": " << ps.chunks << ", \"avg_depth\": " << ps.avg_depth
+			<< ", \"max_depth\": " << ps.max_depth << ", \"stalls\": " << ps.stalls << " }" << endl;
+	os << "}" << endl;
+}
+
 void image_listener(uint32_t offset, const ps_header& hdr)
 {
 	logger::i("  %s (0x%04x, %d b)\n", hdr.filename().c_str(), hdr.signature(), hdr.length());
@@ -287,8 +450,8 @@ int do_script(int argc, char** argv, int opts, const string& profile)
 		return 1;
 	}
 
-	auto intf = interface::create(argv[1], profile);
-	auto rwx = rwx::create(intf, argv[2], opts & opt_safe);
+	auto intf = create_interface(argv[1], profile);
+	auto rwx = create_rwx(intf, argv[2], opts & opt_safe);
 
 	if (argc == 3) {
 		// we're in interactive mode
@@ -317,7 +480,7 @@ int do_script(int argc, char** argv, int opts, const string& profile)
 }
 
 
-int do_dump(int argc, char** argv, int opts, const string& profile)
+int do_dump(int argc, char** argv, int opts, const string& profile, const string& prev_file, unsigned sessions)
 {
 	if (argc != 5) {
 		usage(false);
@@ -328,11 +491,61 @@ int do_dump(int argc, char** argv, int opts, const string& profile)
 		throw user_error("output file "s + argv[4] + " exists; specify -F to overwrite or -R to resume dump");
 	}
 
-	auto intf = interface::create(argv[1], profile);
+	string prev;
+
+	if (sessions > 1) {
+		if (!prev_file.empty() || argv[2] == "special"s || argv[3] == "dumpcode"s) {
+			throw user_error("-j is not supported with -D, or for "s + argv[2] + " " + argv[3]);
+		} else if (starts_with(argv[1], "session:")) {
+			throw user_error("-j is not supported with sessions");
+		} else if (!interface::get_trace_file().empty()) {
+			// each connection would truncate the same trace file
+			throw user_error("-j is not supported with -T");
+		}
+	}
+
+	if (!prev_file.empty()) {
+		if (opts & opt_resume) {
+			throw user_error("-D and -R are mutually exclusive");
+		} else if (argv[2] == "special"s || argv[3] == "dumpcode"s) {
+			throw user_error("-D is not supported for "s + argv[2] + " " + argv[3]);
+		}
+
+		// read this now, in case <out> is the same file
+		ifstream in(prev_file, ios::binary);
+		if (!in.good()) {
+			throw user_error("failed to open " + prev_file + " for reading");
+		}
+
+		prev.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+	}
+
+	auto intf = create_interface(argv[1], profile);
 	rwx::sp rwx;
 
+	vector<rwx::sp> others;
+
 	if (argv[2] != "special"s) {
-		rwx = rwx::create(intf, argv[2], opts & opt_safe);
+		rwx = create_rwx(intf, argv[2], opts & opt_safe);
+
+		if (sessions > 1 && !rwx->can_dump_parallel()) {
+			logger::w() << "parallel dumps not supported for " << argv[2] << "; using one session" << endl;
+			sessions = 1;
+		}
+
+		// connecting takes a while, so do it in parallel
+		vector<future<rwx::sp>> futures;
+		string name = intf->profile() ? intf->profile()->name() : profile;
+
+		for (unsigned i = 1; i < sessions; ++i) {
+			futures.push_back(async(launch::async, [&] {
+				return rwx::create(interface::create(argv[1], name), argv[2], opts & opt_safe);
+			}));
+		}
+
+		for (auto& f : futures) {
+			others.push_back(f.get());
+		}
 	} else {
 		rwx = rwx::create_special(intf, argv[3]);
 	}
@@ -355,12 +568,37 @@ int do_dump(int argc, char** argv, int opts, const string& profile)
 		throw user_error("failed to open "s + argv[4] + " for writing");
 	}
 
-	if (argv[2] != "special"s) {
-		if (argv[3] != "dumpcode"s) {
+	if (!prev_file.empty()) {
+		auto changed = rwx->dump_delta(argv[3], prev, of);
+		uint32_t bytes = 0;
+
+		for (auto r : changed) {
+			logger::i("  0x%08x-0x%08x  (%u b)\n", r.first, r.first + r.second - 1, r.second);
+			bytes += r.second;
+		}
+
+		logger::i("%u b in %u range(s) changed\n", bytes, static_cast<unsigned>(changed.size()));
+	} else if (argv[2] != "special"s) {
+		vector<rwx::sp> rwxs { rwx };
+		rwxs.insert(rwxs.end(), others.begin(), others.end());
+
+		for (auto& r : rwxs) {
+			r->reset_stats();
+		}
+
+		mstimer t;
+
+		if (!others.empty()) {
+			rwx->dump_parallel(argv[3], of, others, opts & opt_resume);
+		} else if (argv[3] != "dumpcode"s) {
 			rwx->dump(argv[3], of, opts & opt_resume);
 		} else {
 			rwx->dump(intf->version().codecfg()["rwcode"] | intf->profile()->kseg1(), 512, of);
 		}
+
+		if (!stats_file.empty()) {
+			write_stats(intf, rwxs, argv[2], t.elapsed());
+		}
 	} else {
 		rwx->dump(0, 0, of);
 	}
@@ -397,8 +635,8 @@ int do_write_exec(int argc, char** argv, int opts, const string& profile)
 		throw user_error("failed to open " + file + " for reading");
 	}
 
-	auto intf = interface::create(argv[1], profile);
-	auto rwx = rwx::create(intf, exec ? "ram" : argv[2], opts & opt_safe);
+	auto intf = create_interface(argv[1], profile);
+	auto rwx = create_rwx(intf, exec ? "ram" : argv[2], opts & opt_safe);
 
 	progress pg;
 
@@ -436,7 +674,7 @@ int do_run(int argc, char** argv, const string& profile)
 		return 1;
 	}
 
-	auto intf = interface::create(argv[1], profile);
+	auto intf = create_interface(argv[1], profile);
 	auto cli = dynamic_pointer_cast<cmdline_interface>(intf);
 	if (!cli) {
 		throw user_error("not a commandline interface");
@@ -459,7 +697,7 @@ int do_info(int argc, char** argv, const string& profile)
 	}
 
 	if (argc == 2) {
-		auto intf = interface::create(argv[1], profile);
+		auto intf = create_interface(argv[1], profile);
 		if (intf->profile()) {
 			intf->profile()->print_to_stdout();
 		}
@@ -479,8 +717,8 @@ int do_scan(int argc, char** argv, int opts, const string& profile)
 		return 1;
 	}
 
-	auto intf = interface::create(argv[1], profile);
-	auto rwx = rwx::create(intf, argv[2], opts & opt_safe);
+	auto intf = create_interface(argv[1], profile);
+	auto rwx = create_rwx(intf, argv[2], opts & opt_safe);
 
 	if (!intf->profile() && argc != 6) {
 		throw user_error("unknown profile, must specify <start> and <size>");
@@ -526,13 +764,326 @@ int do_scan(int argc, char** argv, int opts, const string& profile)
 	return 0;
 }
 
+struct batch_job
+{
+	unsigned line;
+	string intf;
+	string space;
+	string range;
+	string out;
+
+	unsigned attempts = 0;
+	uint32_t length = 0;
+	unsigned long ms = 0;
+	string error;
+	bool ok = false;
+};
+
+class batch_runner
+{
+	public:
+	batch_runner(vector<batch_job>& jobs, int opts, const string& profile, unsigned retries)
+	: m_jobs(jobs), m_opts(opts), m_profile(profile), m_retries(retries)
+	{
+		for (size_t i = 0; i < jobs.size(); ++i) {
+			m_pending.push_back(i);
+		}
+	}
+
+	void run(unsigned threads)
+	{
+		vector<thread> workers;
+		for (unsigned i = 0; i < threads; ++i) {
+			workers.emplace_back([this] { work(); });
+		}
+
+		for (auto& t : workers) {
+			t.join();
+		}
+	}
+
+	private:
+	void work()
+	{
+		unique_lock<mutex> lock(m_mutex);
+
+		while (!m_pending.empty() && !m_stop) {
+			// jobs on the same interface must not run concurrently
+			auto it = find_if(m_pending.begin(), m_pending.end(), [this] (size_t i) {
+				return !m_busy.count(m_jobs[i].intf);
+			});
+
+			if (it == m_pending.end()) {
+				m_cv.wait(lock);
+				continue;
+			}
+
+			batch_job& job = m_jobs[*it];
+			m_pending.erase(it);
+			m_busy.insert(job.intf);
+			++job.attempts;
+
+			lock.unlock();
+			bool retry = run_job(job);
+			lock.lock();
+
+			m_busy.erase(job.intf);
+			if (retry) {
+				m_pending.push_back(&job - &m_jobs[0]);
+			}
+
+			m_cv.notify_all();
+		}
+	}
+
+	bool run_job(batch_job& job)
+	{
+		print(job, "starting" + (job.attempts > 1 ? " (attempt " + to_string(job.attempts) + ")" : ""s));
+		mstimer t;
+
+		try {
+			dump(job);
+			job.ok = true;
+			job.error.clear();
+			print(job, "done");
+		} catch (const user_error& e) {
+			job.error = e.what();
+		} catch (const rwx::interrupted& e) {
+			job.error = "interrupted";
+			m_stop = true;
+		} catch (const exception& e) {
+			job.error = e.what();
+			job.ms += t.elapsed();
+			print(job, "failed: " + job.error);
+
+			if (job.attempts <= m_retries && !m_stop) {
+				this_thread::sleep_for(chrono::seconds(1));
+				return true;
+			}
+
+			return false;
+		}
+
+		job.ms += t.elapsed();
+
+		if (!job.ok) {
+			print(job, "failed: " + job.error);
+		}
+
+		return false;
+	}
+
+	void dump(batch_job& job)
+	{
+		if (job.attempts == 1 && !(m_opts & (opt_force | opt_resume)) && access(job.out.c_str(), F_OK) == 0) {
+			throw user_error("output file " + job.out + " exists");
+		}
+
+		// after a failed attempt, continue where we left off
+		bool resume = (m_opts & opt_resume) || job.attempts > 1;
+		if (resume) {
+			ifstream in(job.out, ios::binary | ios::ate);
+			resume = in.good() && in.tellg() > 0;
+		}
+
+		auto intf = interface::create(job.intf, m_profile);
+		auto rwx = rwx::create(intf, job.space, m_opts & opt_safe);
+
+		uint32_t start = 0;
+		unsigned percent = 0;
+
+		rwx->set_progress_listener([&] (uint32_t offset, uint32_t length, bool write, bool init) {
+			if (init) {
+				start = offset;
+				job.length = length;
+			} else if (job.length && offset != UINT32_MAX) {
+				auto p = 100ull * (offset - start) / job.length;
+				if (p >= percent + 10) {
+					percent = p - (p % 10);
+					print(job, to_string(percent) + "%");
+				}
+			}
+		});
+
+		ios::openmode mode = ios::out | ios::binary | (resume ? ios::in : ios::trunc);
+		ofstream of(job.out, mode);
+		if (!of.good()) {
+			throw user_error("failed to open " + job.out + " for writing");
+		}
+
+		rwx->dump(job.range, of, resume);
+	}
+
+	void print(const batch_job& job, const string& msg)
+	{
+		lock_guard<mutex> lock(m_print_mutex);
+		logger::i() << "[" << job.line << "] " << job.intf << " " << job.space << " "
+				<< job.range << ": " << msg << endl;
+	}
+
+	vector<batch_job>& m_jobs;
+	int m_opts;
+	string m_profile;
+	unsigned m_retries;
+
+	mutex m_mutex;
+	mutex m_print_mutex;
+	condition_variable m_cv;
+	list<size_t> m_pending;
+	set<string> m_busy;
+	atomic<bool> m_stop { false };
+};
+
+vector<batch_job> read_batch_jobs(const string& filename)
+{
+	ifstream in(filename);
+	if (!in.good()) {
+		throw user_error("failed to open " + filename + " for reading");
+	}
+
+	vector<batch_job> jobs;
+	string line;
+
+	for (unsigned n = 1; getline(in, line); ++n) {
+		line = trim(line);
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+
+		batch_job job;
+		job.line = n;
+
+		istringstream istr(line);
+		string extra;
+		if (!(istr >> job.intf >> job.space >> job.range >> job.out) || (istr >> extra)) {
+			throw user_error(filename + ":" + to_string(n) + ": expected <interface> <addrspace> <range> <out>");
+		}
+
+		jobs.push_back(job);
+	}
+
+	return jobs;
+}
+
+int do_batch(int argc, char** argv, int opts, const string& profile)
+{
+	if (argc < 2 || argc > 4) {
+		usage(false);
+		return 1;
+	}
+
+	if (!interface::get_trace_file().empty()) {
+		throw user_error("-T is not supported with batch");
+	}
+
+	auto jobs = read_batch_jobs(argv[1]);
+	if (jobs.empty()) {
+		throw user_error("no jobs in "s + argv[1]);
+	}
+
+	unsigned threads = argc >= 3 ? lexical_cast<unsigned>(argv[2]) : 4;
+	unsigned retries = argc == 4 ? lexical_cast<unsigned>(argv[3]) : 2;
+
+	threads = max(1u, min(threads, unsigned(jobs.size())));
+	logger::i() << "running " << jobs.size() << " job(s) on " << threads << " thread(s)" << endl;
+
+	batch_runner(jobs, opts, profile, retries).run(threads);
+
+	unsigned failed = 0;
+
+	logger::i() << endl << "summary:" << endl;
+	for (auto& job : jobs) {
+		logger::i("  %4u  %-6s  %2u attempt(s)  %9u b  %7.1f s  %s %s %s  %s\n", job.line,
+				job.ok ? "ok" : "FAILED", job.attempts, job.length, job.ms / 1000.0,
+				job.intf.c_str(), job.space.c_str(), job.range.c_str(), job.error.c_str());
+		if (!job.ok) {
+			++failed;
+		}
+	}
+
+	logger::i() << endl << (jobs.size() - failed) << " of " << jobs.size() << " job(s) succeeded" << endl;
+	return failed ? 1 : 0;
+}
+
+int run(int argc, char** argv)
+{
+	try {
+		return do_main(argc, argv);
+	} catch (const rwx::interrupted& e) {
+		handle_sigint();
+	} catch (const errno_error& e) {
+		if (!e.interrupted()) {
+			handle_exception(e);
+		} else {
+			handle_sigint();
+		}
+	} catch (const user_error& e) {
+		handle_exception(e, false);
+		return 1;
+	} catch (const exception& e) {
+		handle_exception(e);
+	}
+
+	// the device may be in an unknown state, so detect it again
+	// on the next request.
+	served.reset();
+	return 1;
+}
+
+int do_serve(int argc, char** argv, const string& profile)
+{
+	if (argc != 3) {
+		usage(false);
+		return 1;
+	} else if (!served.spec.empty() || starts_with(argv[1], "session:")) {
+		throw user_error("cannot serve a session from a session");
+	}
+
+	served.spec = argv[1];
+	served.profile = profile;
+	served.intf = interface::create(served.spec, profile);
+
+	// options given to `serve` itself apply to all requests, while those
+	// of a request must not carry over to the next one.
+	int loglevel = logger::loglevel();
+	auto overrides = profile::get_opt_overrides();
+	string logfile = logger::get_logfile();
+	string trace_file = interface::get_trace_file();
+
+	session::serve(argv[2], [=] (vector<string>& args) {
+		vector<char*> argv;
+		for (auto& arg : args) {
+			argv.push_back(&arg[0]);
+		}
+		argv.push_back(nullptr);
+
+		rwx::clear_interrupted();
+
+		int status = run(argv.size() - 1, argv.data());
+		logger::loglevel(loglevel);
+		logger::no_stdout(false);
+		profile::set_opt_overrides(overrides);
+		interface::set_trace_file(trace_file);
+
+		if (logger::get_logfile() != logfile) {
+			logger::set_logfile(logfile);
+		}
+
+		return status;
+	});
+
+	return 0;
+}
+
 }
 
 int do_main(int argc, char** argv)
 {
 	ios_base::sync_with_stdio();
 	string profile;
+	string prev_file;
 	int loglevel = logger::info;
+	unsigned sessions = 1;
 	int opts = 0;
 	int opt;
 
@@ -543,10 +1094,25 @@ int do_main(int argc, char** argv)
 	}
 #endif
 
+	vector<string> args(argv, argv + argc);
 	opterr = 0;
+	// 0 also resets getopt's internal state, since we're called
+	// once per request when serving a session.
+	optind = 0;
+
+	const option long_opts[] = {
+		{ "help", no_argument, nullptr, 'h' },
+		{ "stats", required_argument, nullptr, opt_long_stats },
+		{ nullptr, 0, nullptr, 0 },
+	};
 
-	while ((opt = getopt(argc, argv, "hsARFqvP:L:O:")) != -1) {
+	stats_file.clear();
+
+	while ((opt = getopt_long(argc, argv, "hsARFqvP:L:O:D:T:j:", long_opts, nullptr)) != -1) {
 		switch (opt) {
+		case opt_long_stats:
+			stats_file = optarg;
+			break;
 		case 's':
 			opts |= opt_safe;
 			break;
@@ -566,6 +1132,12 @@ int do_main(int argc, char** argv)
 		case 'R':
 			opts |= opt_resume;
 			break;
+		case 'D':
+			prev_file = optarg;
+			break;
+		case 'j':
+			sessions = max(lexical_cast<unsigned>(optarg), 1u);
+			break;
 		case 'P':
 			profile = optarg;
 			break;
@@ -575,6 +1147,9 @@ int do_main(int argc, char** argv)
 		case 'L':
 			logger::set_logfile(optarg);
 			break;
+		case 'T':
+			interface::set_trace_file(optarg);
+			break;
 		case 'h':
 		default:
 			bool help = (opt == 'h' || (optopt == '-' && argv[optind] == "help"s));
@@ -594,6 +1169,10 @@ int do_main(int argc, char** argv)
 	argv += optind;
 	argc -= optind;
 
+	if (argc >= 2 && cmd != "serve" && served.spec.empty() && starts_with(argv[1], "session:")) {
+		return session::run(string(argv[1]).substr(8), args);
+	}
+
 	if (cmd == "run" || cmd == "script") {
 		logger::no_stdout();
 	}
@@ -605,13 +1184,17 @@ int do_main(int argc, char** argv)
 	} else if (cmd == "run") {
 		return do_run(argc, argv, profile);
 	} else if (cmd == "dump") {
-		return do_dump(argc, argv, opts, profile);
+		return do_dump(argc, argv, opts, profile, prev_file, sessions);
 	} else if (cmd == "write" || cmd == "exec") {
 		return do_write_exec(argc, argv, opts, profile);
 	} else if (cmd == "scan") {
 		return do_scan(argc, argv, opts, profile);
 	} else if (cmd == "script") {
 		return do_script(argc, argv, opts, profile);
+	} else if (cmd == "batch") {
+		return do_batch(argc, argv, opts, profile);
+	} else if (cmd == "serve") {
+		return do_serve(argc, argv, profile);
 	} else {
 		usage(false);
 		return 1;
@@ -620,21 +1203,5 @@ int do_main(int argc, char** argv)
 
 int main(int argc, char** argv)
 {
-	try {
-		return do_main(argc, argv);
-	} catch (const rwx::interrupted& e) {
-		handle_sigint();
-	} catch (const errno_error& e) {
-		if (!e.interrupted()) {
-			handle_exception(e);
-		} else {
-			handle_sigint();
-		}
-	} catch (const user_error& e) {
-		handle_exception(e, false);
-	} catch (const exception& e) {
-		handle_exception(e);
-	}
-
-	return 1;
+	return run(argc, argv);
 }
@@ -0,0 +1,1213 @@
+/**
+ * bcm2-utils
+ * Copyright (C) 2016-2023 Joseph Lehner <joseph.c.lehner@gmail.com>
+ *
+ * bcm2-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bcm2-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bcm2-utils.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Emulates the BFC and bootloader consoles of a device, backed by
+// memory and flash images. Only meant for testing and benchmarking
+// bcm2dump; nothing is ever actually executed, but the dump code's
+// protocol is emulated natively.
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdexcept>
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <condition_variable>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <array>
+#include <deque>
+#include <unistd.h>
+#include "rwcode2.h"
+#include "profile.h"
+#include "asmdef.h"
+#include "util.h"
+using namespace bcm2dump;
+using namespace std;
+
+namespace {
+
+struct options
+{
+	string profile = "generic";
+	string version;
+	bool bootloader = false;
+	// bytes per second (0 = unlimited)
+	unsigned rate = 0;
+	// milliseconds per command
+	unsigned latency = 0;
+	// probability of dropping / corrupting an output line
+	double drop = 0;
+	double corrupt = 0;
+	// number of clients that are served at the same time
+	unsigned clients = 1;
+	// ignore the output format flags, like older versions of the dump code
+	bool legacy_code = false;
+};
+
+class memory
+{
+	public:
+	uint8_t get(uint32_t addr) const
+	{
+		lock_guard<recursive_mutex> lock(m_mutex);
+		auto it = m_pages.find(phys(addr) / page_size);
+		return it != m_pages.end() ? it->second[phys(addr) % page_size] : 0;
+	}
+
+	void set(uint32_t addr, uint8_t val)
+	{
+		lock_guard<recursive_mutex> lock(m_mutex);
+		auto& page = m_pages[phys(addr) / page_size];
+		if (page.empty()) {
+			page.resize(page_size);
+		}
+		page[phys(addr) % page_size] = val;
+	}
+
+	string read(uint32_t addr, uint32_t length) const
+	{
+		lock_guard<recursive_mutex> lock(m_mutex);
+		string ret;
+		ret.reserve(length);
+		for (uint32_t i = 0; i < length; ++i) {
+			ret += char(get(addr + i));
+		}
+		return ret;
+	}
+
+	void write(uint32_t addr, const string& buf)
+	{
+		lock_guard<recursive_mutex> lock(m_mutex);
+		for (size_t i = 0; i < buf.size(); ++i) {
+			set(addr + i, buf[i]);
+		}
+	}
+
+	uint32_t word(uint32_t addr) const
+	{ return be_to_h(extract<uint32_t>(read(addr, 4))); }
+
+	void word(uint32_t addr, uint32_t val)
+	{ write(addr, to_buf(h_to_be(val))); }
+
+	private:
+	static constexpr uint32_t page_size = 4096;
+
+	// kseg0 and kseg1 map to the same physical memory
+	static uint32_t phys(uint32_t addr)
+	{ return addr & 0x1fffffff; }
+
+	map<uint32_t, vector<uint8_t>> m_pages;
+	mutable recursive_mutex m_mutex;
+};
+
+class console
+{
+	public:
+	console(int fd, const options& opts)
+	: m_fd(fd), m_opts(opts), m_rng(random_device()())
+	{}
+
+	~console()
+	{ ::close(m_fd); }
+
+	int getc()
+	{
+		if (m_rxbeg == m_rxbuf.size()) {
+			char buf[4096];
+			ssize_t n = ::read(m_fd, buf, sizeof(buf));
+			if (n <= 0) {
+				throw runtime_error("connection closed");
+			}
+
+			m_rxbuf.assign(buf, n);
+			m_rxbeg = 0;
+		}
+
+		return m_rxbuf[m_rxbeg++] & 0xff;
+	}
+
+	// reads a line, terminated by either "\r", "\n", or "\r\n"
+	string getline(bool echo = true)
+	{
+		string line;
+
+		while (true) {
+			int c = getc();
+			if (c == '\n' && m_cr) {
+				m_cr = false;
+				continue;
+			}
+
+			m_cr = (c == '\r');
+
+			if (c == '\r' || c == '\n') {
+				break;
+			} else if (c == 0x7f || c == '\b') {
+				if (!line.empty()) {
+					line.pop_back();
+				}
+			} else {
+				line += char(c);
+			}
+		}
+
+		if (echo) {
+			println(line, false);
+		}
+
+		return line;
+	}
+
+	// reads a single character, skipping the "\n" of a "\r\n"
+	int getkey()
+	{
+		int c = getc();
+		if (c == '\n' && m_cr) {
+			c = getc();
+		}
+
+		m_cr = (c == '\r');
+		return c;
+	}
+
+	void print(const string& str)
+	{
+		send(str);
+	}
+
+	void println(string line = "", bool noise = true)
+	{
+		if (noise && !line.empty()) {
+			if (chance(m_opts.drop)) {
+				return;
+			} else if (chance(m_opts.corrupt)) {
+				line[m_rng() % line.size()] ^= (1 << (m_rng() % 7));
+			}
+		}
+
+		send(line + "\r\n");
+	}
+
+	void delay()
+	{
+		if (m_opts.latency) {
+			this_thread::sleep_for(chrono::milliseconds(m_opts.latency));
+		}
+	}
+
+	private:
+	bool chance(double p)
+	{ return p > 0 && uniform_real_distribution<double>(0, 1)(m_rng) < p; }
+
+	void send(const string& str)
+	{
+		if (::send(m_fd, str.data(), str.size(), MSG_NOSIGNAL) != ssize_t(str.size())) {
+			throw errno_error("send");
+		}
+
+		if (m_opts.rate) {
+			this_thread::sleep_for(chrono::microseconds(1000000ull * str.size() / m_opts.rate));
+		}
+	}
+
+	int m_fd;
+	const options& m_opts;
+	string m_rxbuf;
+	size_t m_rxbeg = 0;
+	bool m_cr = false;
+	mt19937 m_rng;
+};
+
+class device
+{
+	public:
+	device(const options& opts)
+	: m_opts(opts), m_profile(profile::get(opts.profile))
+	{
+		int intf = opts.bootloader ? BCM2_INTF_BLDR : BCM2_INTF_BFC;
+
+		for (auto v : m_profile->versions()) {
+			if (v.intf() & intf && (opts.version.empty() || v.name() == opts.version)) {
+				m_version = v;
+				break;
+			}
+		}
+
+		if (m_version.name().empty()) {
+			if (!opts.version.empty()) {
+				throw user_error("no such version: " + opts.version);
+			}
+			m_version = m_profile->default_version(intf);
+		}
+
+		if (m_version.raw() && m_version.magic()->addr) {
+			m_ram.write(m_version.magic()->addr, magic_data(m_version.magic()));
+		}
+
+		for (auto m : m_profile->magics()) {
+			if (m->addr) {
+				m_ram.write(m->addr, magic_data(m));
+			}
+		}
+	}
+
+	memory& ram()
+	{ return m_ram; }
+
+	string& flash()
+	{ return m_flash; }
+
+	void serve(console& con)
+	{
+		{
+			lock_guard<mutex> lock(m_console_mutex);
+			m_console = &con;
+		}
+
+		cleaner c { [this, &con] {
+			lock_guard<mutex> lock(m_console_mutex);
+			if (m_console == &con) {
+				m_console = nullptr;
+			}
+		}};
+
+		if (m_opts.bootloader) {
+			serve_bootloader(con);
+		} else {
+			serve_bfc(con);
+		}
+	}
+
+	// calls a function from outside the console (i.e. via snmp). its
+	// output is sent to the most recently connected console.
+	bool exec(uint32_t addr)
+	{
+		lock_guard<mutex> lock(m_console_mutex);
+		return m_console && call(*m_console, addr);
+	}
+
+	private:
+	uint8_t flash_get(uint32_t offset) const
+	{ return offset < m_flash.size() ? m_flash[offset] : 0xff; }
+
+	void flash_set(uint32_t offset, uint8_t val)
+	{
+		if (offset >= m_flash.size()) {
+			m_flash.resize(offset + 1, '\xff');
+		}
+		m_flash[offset] = val;
+	}
+
+	uint32_t flash_word(uint32_t offset) const
+	{
+		uint32_t ret = 0;
+		for (unsigned i = 0; i < 4; ++i) {
+			ret = (ret << 8) | flash_get(offset + i);
+		}
+		return ret;
+	}
+
+	void serve_bfc(console& con);
+	void serve_bootloader(console& con);
+	void print_main_menu(console& con);
+	bool call(console& con, uint32_t addr);
+	void rwcode_read(console& con, uint32_t args);
+	void rwcode_write(console& con, uint32_t args);
+
+	const options& m_opts;
+	profile::sp m_profile;
+	version m_version;
+	memory m_ram;
+	string m_flash;
+	string m_partition;
+	mutex m_console_mutex;
+	console* m_console = nullptr;
+};
+
+void device::serve_bfc(console& con)
+{
+	const string prompt = "CM> ";
+
+	while (true) {
+		auto args = split(trim(con.getline()), ' ', false);
+		con.delay();
+
+		if (args.empty()) {
+			// just print the prompt
+		} else if (args[0] == "/version") {
+			con.println("Broadband Firmware Console emulator");
+			if (m_profile->pssig()) {
+				con.println("PID=" + to_hex(m_profile->pssig(), 4));
+			}
+		} else if (args[0] == "/read_memory" && args.size() == 6) {
+			uint32_t length = lexical_cast<uint32_t>(args[4], 0);
+			uint32_t addr = lexical_cast<uint32_t>(args[5], 0);
+
+			con.println();
+
+			for (uint32_t i = 0; i < length; i += 16) {
+				string line = to_hex(addr + i) + ":";
+				string ascii;
+
+				for (uint32_t k = 0; k < 16; k += 4) {
+					line += (k ? "  " : " ") + to_hex(m_ram.word(addr + i + k));
+					for (char c : m_ram.read(addr + i + k, 4)) {
+						ascii += isprint(c & 0xff) ? c : '.';
+					}
+				}
+
+				con.println(line + " | " + ascii);
+			}
+
+			con.println();
+		} else if (args[0] == "/write_memory" && args.size() == 5) {
+			unsigned size = lexical_cast<unsigned>(args[2]);
+			uint32_t addr = lexical_cast<uint32_t>(args[3], 0);
+			uint32_t val = lexical_cast<uint32_t>(args[4], 0);
+
+			if (size == 4) {
+				m_ram.word(addr, val);
+			} else {
+				m_ram.set(addr, val & 0xff);
+			}
+
+			con.println("Writing " + to_string(size) + " bytes to 0x" + to_hex(addr));
+		} else if (args[0] == "/call" && args.size() == 4) {
+			uint32_t addr = lexical_cast<uint32_t>(args[3], 0);
+			con.println("Calling function 0x" + to_hex(addr));
+			call(con, addr);
+		} else if (args[0] == "/flash/open" && args.size() == 2) {
+			if (!m_partition.empty()) {
+				con.println("Flash device opened twice!");
+			} else {
+				m_partition = args[1];
+				con.println("Flash driver opened");
+			}
+		} else if (args[0] == "/flash/close") {
+			m_partition.clear();
+			con.println("Flash driver closed");
+		} else if (args[0] == "/flash/init") {
+			con.println("Initializing flash driver");
+		} else if (args[0] == "/flash/deinit") {
+			m_partition.clear();
+			con.println("Deinitializing flash driver");
+		} else if ((args[0] == "/flash/read" && args.size() == 4) || (args[0] == "/flash/readDirect" && args.size() == 3)) {
+			bool direct = (args.size() == 3);
+			uint32_t length = lexical_cast<uint32_t>(args[direct ? 1 : 2]);
+			uint32_t offset = lexical_cast<uint32_t>(args[direct ? 2 : 3]);
+
+			con.println();
+
+			for (uint32_t i = 0; i < length; i += (direct ? 16 : 32)) {
+				string line;
+
+				if (direct) {
+					for (uint32_t k = 0; k < 16 && (i + k) < length; ++k) {
+						line += (!k ? "" : (k % 4) ? " " : "   ") + to_hex(flash_get(offset + i + k));
+					}
+				} else {
+					for (uint32_t k = 0; k < 32 && (i + k) < length; k += 4) {
+						line += (k ? " " : "") + to_hex(flash_word(offset + i + k));
+					}
+				}
+
+				con.println(line);
+			}
+
+			con.println();
+		} else if (args[0] == "/flash/write" && args.size() == 4) {
+			unsigned size = lexical_cast<unsigned>(args[1]);
+			uint32_t offset = lexical_cast<uint32_t>(args[2], 0);
+			uint32_t val = lexical_cast<uint32_t>(args[3], 0);
+
+			for (unsigned i = 0; i < size; ++i) {
+				flash_set(offset + i, val >> (8 * (size - i - 1)));
+			}
+
+			con.println("Value successfully written");
+		} else if (args[0] == "/exit") {
+			return;
+		} else if (args[0][0] == '/') {
+			con.println("ERROR: Unknown command: " + args[0]);
+		}
+
+		con.print(prompt);
+	}
+}
+
+void device::print_main_menu(console& con)
+{
+	con.println();
+	con.println("Main Menu:");
+	con.println("==========");
+	con.println("  b) Boot from flash");
+	con.println("  r) Read memory");
+	con.println("  w) Write memory");
+	con.println("  j) Jump to arbitrary address");
+	con.println("  X) Reset");
+	con.print("[b, r, w, j, X]: ");
+}
+
+void device::serve_bootloader(console& con)
+{
+	print_main_menu(con);
+
+	while (true) {
+		int c = con.getkey();
+		con.delay();
+
+		if (c == 'r') {
+			con.println("r");
+			con.println("Read memory.");
+
+			while (true) {
+				con.print("Enter address (hex): ");
+				string line = trim(con.getline());
+				if (line.empty()) {
+					break;
+				}
+
+				uint32_t addr = lexical_cast<uint32_t>(line, 16);
+				con.delay();
+				con.println("Value at " + to_hex(addr) + ": " + to_hex(m_ram.word(addr)) + " (hex)");
+			}
+		} else if (c == 'w') {
+			con.println("w");
+			con.println("Write memory.");
+			con.print("Enter address (hex): ");
+			uint32_t addr = lexical_cast<uint32_t>(trim(con.getline()), 16);
+			con.print("Enter value (hex): ");
+			m_ram.word(addr, lexical_cast<uint32_t>(trim(con.getline()), 16));
+		} else if (c == 'j') {
+			con.println("j");
+			con.print("Enter jump address (hex): ");
+			uint32_t addr = lexical_cast<uint32_t>(trim(con.getline()), 16);
+			if (!call(con, addr)) {
+				con.println("******************** CRASH ********************");
+				return;
+			}
+		} else if (c == 'X') {
+			return;
+		} else if (c != '\r' && c != '\n') {
+			continue;
+		}
+
+		print_main_menu(con);
+	}
+}
+
+bool device::call(console& con, uint32_t addr)
+{
+	uint32_t rwcode = m_version.raw() ? m_version.codecfg("rwcode") : 0;
+
+	if (rwcode && (addr & 0x1fffffff) == (rwcode & 0x1fffffff) + sizeof(bcm2_read_args)) {
+		rwcode_read(con, addr - sizeof(bcm2_read_args));
+	} else if (rwcode && (addr & 0x1fffffff) == (rwcode & 0x1fffffff) + sizeof(bcm2_write_args)) {
+		rwcode_write(con, addr - sizeof(bcm2_write_args));
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+// see mips_read() in rwcode2.c
+void device::rwcode_read(console& con, uint32_t a)
+{
+	auto field = [a] (size_t off) { return a + off; };
+
+	uint32_t flags = m_ram.word(field(offsetof(bcm2_read_args, flags)));
+	uint32_t buffer = m_ram.word(field(offsetof(bcm2_read_args, buffer)));
+	uint32_t offset = m_ram.word(field(offsetof(bcm2_read_args, offset)));
+	uint32_t length = m_ram.word(field(offsetof(bcm2_read_args, length)));
+	uint32_t chunklen = m_ram.word(field(offsetof(bcm2_read_args, chunklen)));
+	uint32_t index = m_ram.word(field(offsetof(bcm2_read_args, index)));
+	uint32_t fl_read = m_ram.word(field(offsetof(bcm2_read_args, fl_read)));
+
+	if (m_opts.legacy_code) {
+		flags &= ~(BCM2_READ_FMT_BASE64 | BCM2_READ_FMT_RLE | BCM2_READ_FMT_CRC32);
+	}
+
+	chunklen = min(length - index, chunklen);
+	if (!length || !chunklen) {
+		return;
+	}
+
+	string data;
+
+	if (fl_read) {
+		for (uint32_t i = 0; i < chunklen; ++i) {
+			m_ram.set(buffer + i, flash_get(offset + index + i));
+		}
+		data = m_ram.read(buffer, chunklen);
+	} else {
+		data = m_ram.read(buffer + index, chunklen);
+	}
+
+	m_ram.word(field(offsetof(bcm2_read_args, index)), index + chunklen);
+
+	if (flags & BCM2_READ_FMT_CRC32) {
+		con.println("#" + to_hex(crc32(data), 0));
+		return;
+	}
+
+	for (size_t pos = 0; pos < data.size();) {
+		if (flags & BCM2_READ_FMT_RLE) {
+			uint32_t word = extract<uint32_t>(data, pos);
+			size_t n = 1;
+
+			while ((pos + (n + 1) * 4) <= data.size() && extract<uint32_t>(data, pos + n * 4) == word) {
+				++n;
+			}
+
+			n &= ~3;
+
+			if (n >= 8) {
+				con.println("*" + to_hex(n, 0) + ":" + to_hex(be_to_h(word), 0));
+				pos += n * 4;
+				continue;
+			}
+		}
+
+		if (!(flags & BCM2_READ_FMT_BASE64)) {
+			string line;
+			for (unsigned i = 0; i < 16; i += 4) {
+				line += ":" + to_hex(be_to_h(extract<uint32_t>(data, pos + i)), 0);
+			}
+
+			con.println(line);
+			pos += 16;
+			continue;
+		}
+
+		static const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+		string raw = data.substr(pos, 48);
+		pos += raw.size();
+		append_buf(raw, h_to_be(crc16_ccitt(raw)));
+
+		string line = "@";
+
+		for (size_t i = 0; i < raw.size(); i += 3) {
+			uint32_t v = 0;
+			for (size_t k = 0; k < 3; ++k) {
+				v = (v << 8) | ((i + k) < raw.size() ? (raw[i + k] & 0xff) : 0);
+			}
+
+			for (size_t k = 0; k < 4; ++k) {
+				line += (k <= (raw.size() - i)) ? alphabet[(v >> (18 - 6 * k)) & 0x3f] : '=';
+			}
+		}
+
+		con.println(line);
+	}
+}
+
+// see mips_write() in rwcode2.c
+void device::rwcode_write(console& con, uint32_t a)
+{
+	auto field = [a] (size_t off) { return a + off; };
+
+	uint32_t buffer = m_ram.word(field(offsetof(bcm2_write_args, buffer)));
+	uint32_t offset = m_ram.word(field(offsetof(bcm2_write_args, offset)));
+	uint32_t length = m_ram.word(field(offsetof(bcm2_write_args, length)));
+	uint32_t chunklen = m_ram.word(field(offsetof(bcm2_write_args, chunklen)));
+	uint32_t index = m_ram.word(field(offsetof(bcm2_write_args, index)));
+	uint32_t fl_write = m_ram.word(field(offsetof(bcm2_write_args, fl_write)));
+	uint32_t ack_interval = m_ram.word(field(offsetof(bcm2_write_args, ack_interval)));
+
+	if (!length) {
+		return;
+	}
+
+	uint32_t len = min(length - index, chunklen);
+	uint32_t lines = 0;
+	uint32_t p = buffer + index;
+
+	m_ram.word(field(offsetof(bcm2_write_args, index)), index + len);
+
+	for (; len; len -= 8, p += 8) {
+		string line = con.getline();
+		unsigned w1, w2;
+
+		if (sscanf(line.c_str(), ":%x:%x", &w1, &w2) != 2) {
+			return;
+		}
+
+		m_ram.word(p, w1);
+		m_ram.word(p + 4, w2);
+
+		if (len == 8 || ack_interval <= 1 || !(++lines % ack_interval)) {
+			con.println(":" + to_hex(fl_write ? offset + (p - buffer) : p, 0));
+		}
+	}
+
+	if (fl_write && (index + min(length - index, chunklen)) == length) {
+		for (uint32_t i = 0; i < length; ++i) {
+			flash_set(offset + i, m_ram.get(buffer + i));
+		}
+	}
+}
+
+// A minimal SNMPv2c agent, implementing just enough of the engineering MIB
+// to be used with bcm2dump's snmp interface. Responses are delayed by the
+// configured latency, but requests are handled as soon as they arrive, so
+// several requests may be in flight at the same time.
+class snmp_agent
+{
+	public:
+	snmp_agent(device& dev, const options& opts)
+	: m_dev(dev), m_ram(dev.ram()), m_opts(opts)
+	{}
+
+	void serve(uint16_t port)
+	{
+		m_fd = socket(AF_INET, SOCK_DGRAM, 0);
+		if (m_fd < 0) {
+			throw errno_error("socket");
+		}
+
+		sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_port = h_to_be(port);
+		addr.sin_addr.s_addr = h_to_be(uint32_t(INADDR_LOOPBACK));
+
+		if (::bind(m_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+			throw errno_error("bind");
+		}
+
+		logger::v() << "snmp: listening on 127.0.0.1:" << port << endl;
+
+		thread sender(&snmp_agent::send_responses, this);
+		sender.detach();
+
+		while (true) {
+			char buf[65536];
+			sockaddr_in peer;
+			socklen_t peerlen = sizeof(peer);
+
+			ssize_t n = recvfrom(m_fd, buf, sizeof(buf), 0, reinterpret_cast<sockaddr*>(&peer), &peerlen);
+			if (n < 0) {
+				throw errno_error("recvfrom");
+			}
+
+			string response;
+
+			try {
+				response = handle(string(buf, n));
+			} catch (const exception& e) {
+				logger::d() << "snmp: " << e.what() << endl;
+				continue;
+			}
+
+			lock_guard<mutex> lock(m_mutex);
+			m_responses.push_back({ chrono::steady_clock::now() + chrono::milliseconds(m_opts.latency),
+					peer, response });
+			m_cv.notify_all();
+		}
+	}
+
+	private:
+	enum {
+		CMD_READ = 0,
+		CMD_WRITE = 1,
+		CMD_EXEC = 99,
+	};
+
+	enum {
+		BER_INTEGER = 0x02,
+		BER_OCTET_STR = 0x04,
+		BER_NULL = 0x05,
+		BER_OID = 0x06,
+		BER_SEQUENCE = 0x30,
+		BER_UNSIGNED = 0x42,
+		BER_NO_SUCH_OBJECT = 0x80,
+		PDU_GET = 0xa0,
+		PDU_RESPONSE = 0xa2,
+		PDU_SET = 0xa3,
+	};
+
+	struct response
+	{
+		chrono::steady_clock::time_point due;
+		sockaddr_in peer;
+		string data;
+	};
+
+	class ber_reader
+	{
+		public:
+		ber_reader(const string& buf) : m_buf(buf) {}
+
+		int read(string& value)
+		{
+			if (m_pos + 2 > m_buf.size()) {
+				throw runtime_error("truncated message");
+			}
+
+			int tag = m_buf[m_pos++] & 0xff;
+			size_t len = m_buf[m_pos++] & 0xff;
+
+			if (len & 0x80) {
+				unsigned n = len & 0x7f;
+				if (n > 4 || m_pos + n > m_buf.size()) {
+					throw runtime_error("invalid length");
+				}
+
+				for (len = 0; n; --n) {
+					len = (len << 8) | (m_buf[m_pos++] & 0xff);
+				}
+			}
+
+			if (m_pos + len > m_buf.size()) {
+				throw runtime_error("truncated message");
+			}
+
+			value = m_buf.substr(m_pos, len);
+			m_pos += len;
+			return tag;
+		}
+
+		string read(int expected)
+		{
+			string value;
+			if (read(value) != expected) {
+				throw runtime_error("unexpected tag");
+			}
+			return value;
+		}
+
+		bool eof() const
+		{ return m_pos >= m_buf.size(); }
+
+		private:
+		string m_buf;
+		size_t m_pos = 0;
+	};
+
+	static string tlv(int tag, const string& value)
+	{
+		string ret(1, char(tag));
+
+		if (value.size() < 0x80) {
+			ret += char(value.size());
+		} else {
+			ret += char(0x82);
+			ret += char(value.size() >> 8);
+			ret += char(value.size());
+		}
+
+		return ret + value;
+	}
+
+	static string ber_int(int64_t n, int tag = BER_INTEGER)
+	{
+		string ret;
+
+		do {
+			ret.insert(ret.begin(), char(n & 0xff));
+			n >>= 8;
+		} while (n != 0 && n != -1);
+
+		// make sure the sign bit is correct
+		if ((n == 0) != !(ret[0] & 0x80)) {
+			ret.insert(ret.begin(), char(n));
+		}
+
+		return tlv(tag, ret);
+	}
+
+	static int64_t parse_int(const string& value)
+	{
+		int64_t n = (!value.empty() && (value[0] & 0x80)) ? -1 : 0;
+		for (char c : value) {
+			n = (n << 8) | (c & 0xff);
+		}
+		return n;
+	}
+
+	static string oid(const string& str)
+	{
+		auto arcs = split(str, '.');
+		string ret(1, char(40 * lexical_cast<unsigned>(arcs[0]) + lexical_cast<unsigned>(arcs[1])));
+
+		for (size_t i = 2; i < arcs.size(); ++i) {
+			uint32_t arc = lexical_cast<uint32_t>(arcs[i]);
+			string enc(1, char(arc & 0x7f));
+			while (arc >>= 7) {
+				enc.insert(enc.begin(), char(0x80 | (arc & 0x7f)));
+			}
+			ret += enc;
+		}
+
+		return ret;
+	}
+
+	string handle(const string& buf)
+	{
+		ber_reader msg(ber_reader(buf).read(BER_SEQUENCE));
+		string version = msg.read(BER_INTEGER);
+		string community = msg.read(BER_OCTET_STR);
+
+		string pdu;
+		int type = msg.read(pdu);
+		if (type != PDU_GET && type != PDU_SET) {
+			throw runtime_error("unsupported pdu type 0x" + to_hex(type, 2));
+		}
+
+		ber_reader req(pdu);
+		string reqid = req.read(BER_INTEGER);
+		req.read(BER_INTEGER);
+		req.read(BER_INTEGER);
+		ber_reader vars(req.read(BER_SEQUENCE));
+
+		string varbinds;
+		unsigned error = 0, index = 0;
+
+		for (unsigned i = 1; !vars.eof(); ++i) {
+			ber_reader vb(vars.read(BER_SEQUENCE));
+			string name = vb.read(BER_OID);
+			string value;
+			int tag = vb.read(value);
+
+			string ret;
+
+			if (type == PDU_GET) {
+				ret = get(name);
+			} else if (!set(name, parse_int(value), tag) && !error) {
+				// notWritable
+				error = 17;
+				index = i;
+			} else {
+				ret = tlv(tag, value);
+			}
+
+			varbinds += tlv(BER_SEQUENCE, tlv(BER_OID, name) + (ret.empty() ? tlv(tag, value) : ret));
+		}
+
+		string resp = tlv(BER_INTEGER, reqid) + ber_int(error) + ber_int(index) + tlv(BER_SEQUENCE, varbinds);
+		return tlv(BER_SEQUENCE, tlv(BER_INTEGER, version) + tlv(BER_OCTET_STR, community) + tlv(PDU_RESPONSE, resp));
+	}
+
+	string get(const string& name)
+	{
+		lock_guard<mutex> lock(m_mutex);
+
+		if (name == m_mem_addr) {
+			return ber_int(m_addr, BER_UNSIGNED);
+		} else if (name == m_mem_size) {
+			return ber_int(m_size, BER_UNSIGNED);
+		} else if (name == m_mem_data) {
+			return ber_int(m_data, BER_UNSIGNED);
+		} else if (name == m_mem_cmd) {
+			return ber_int(m_cmd);
+		}
+
+		return tlv(BER_NO_SUCH_OBJECT, "");
+	}
+
+	bool set(const string& name, int64_t value, int tag)
+	{
+		lock_guard<mutex> lock(m_mutex);
+
+		if (name == m_engr_enable) {
+			return true;
+		} else if (name == m_mem_addr) {
+			m_addr = value;
+		} else if (name == m_mem_size) {
+			m_size = value;
+		} else if (name == m_mem_data) {
+			m_data = value;
+		} else if (name == m_mem_cmd) {
+			m_cmd = value;
+			run_mem_command();
+		} else {
+			return false;
+		}
+
+		return true;
+	}
+
+	void run_mem_command()
+	{
+		uint32_t size = min(m_size, 4u);
+
+		if (m_cmd == CMD_READ) {
+			m_data = 0;
+			for (uint32_t i = 0; i < size; ++i) {
+				m_data = (m_data << 8) | m_ram.get(m_addr + i);
+			}
+		} else if (m_cmd == CMD_WRITE) {
+			for (uint32_t i = 0; i < size; ++i) {
+				m_ram.set(m_addr + i, m_data >> (8 * (size - i - 1)));
+			}
+		} else if (m_cmd == CMD_EXEC) {
+			logger::v() << "snmp: exec 0x" << to_hex(m_addr) << endl;
+			if (!m_dev.exec(m_addr)) {
+				logger::v() << "snmp: no handler for 0x" << to_hex(m_addr) << endl;
+			}
+		}
+	}
+
+	void send_responses()
+	{
+		unique_lock<mutex> lock(m_mutex);
+
+		while (true) {
+			m_cv.wait(lock, [this] { return !m_responses.empty(); });
+
+			auto r = m_responses.front();
+			if (chrono::steady_clock::now() < r.due) {
+				m_cv.wait_until(lock, r.due);
+				continue;
+			}
+
+			m_responses.pop_front();
+			lock.unlock();
+
+			sendto(m_fd, r.data.data(), r.data.size(), 0, reinterpret_cast<const sockaddr*>(&r.peer), sizeof(r.peer));
+
+			lock.lock();
+		}
+	}
+
+	const string m_engr_enable = oid("1.3.6.1.4.1.4413.2.99.1.1.1.2.1.2.1");
+	const string m_mem_addr = oid("1.3.6.1.4.1.4413.2.99.1.1.3.1.1.0");
+	const string m_mem_size = oid("1.3.6.1.4.1.4413.2.99.1.1.3.1.2.0");
+	const string m_mem_data = oid("1.3.6.1.4.1.4413.2.99.1.1.3.1.3.0");
+	const string m_mem_cmd = oid("1.3.6.1.4.1.4413.2.99.1.1.3.1.4.0");
+
+	device& m_dev;
+	memory& m_ram;
+	const options& m_opts;
+	int m_fd = -1;
+	mutex m_mutex;
+	condition_variable m_cv;
+	deque<response> m_responses;
+	uint32_t m_addr = 0;
+	uint32_t m_size = 4;
+	uint32_t m_data = 0;
+	int32_t m_cmd = 0;
+};
+
+string read_file(const string& filename)
+{
+	ifstream in(filename, ios::binary);
+	if (!in.good()) {
+		throw user_error("failed to open " + filename + " for reading");
+	}
+
+	return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+}
+
+void usage()
+{
+	ostream& os = logger::i();
+
+	os << "Usage: bcm2emu [<options>] <port>" << endl;
+	os << endl;
+	os << "Options:" << endl;
+	os << "  -P <profile>     Profile (default: generic)" << endl;
+	os << "  -V <version>     Firmware version" << endl;
+	os << "  -B               Emulate bootloader instead of BFC console" << endl;
+	os << "  -r <file>[,<off>] Load ram image (default offset: 0x80000000)" << endl;
+	os << "  -f <file>        Load flash image" << endl;
+	os << "  -b <rate>        Line rate, in bytes per second" << endl;
+	os << "  -l <ms>          Latency per command" << endl;
+	os << "  -n <p>           Probability of dropping an output line" << endl;
+	os << "  -c <p>           Probability of corrupting an output line" << endl;
+	os << "  -s <clients>     Serve multiple clients at the same time" << endl;
+	os << "  -C               Emulate dump code without crc32, base64 and run-length output" << endl;
+	os << "  -S <port>        Also serve the SNMP engineering MIB on a UDP port" << endl;
+	os << "  -v               Increase verbosity" << endl;
+	os << endl;
+	os << "The emulator listens on 127.0.0.1:<port>, and can be used with" << endl;
+	os << "bcm2dump's raw TCP interface, e.g. 127.0.0.1,<port>. The SNMP" << endl;
+	os << "agent can be used with snmp:127.0.0.1:<port>." << endl;
+}
+
+int do_main(int argc, char** argv)
+{
+	options opts;
+	vector<pair<string, uint32_t>> ram_images;
+	string flash_image;
+	uint16_t snmp_port = 0;
+	int loglevel = logger::info;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "hBCvP:V:r:f:b:l:n:c:s:S:")) != -1) {
+		switch (opt) {
+		case 'P':
+			opts.profile = optarg;
+			break;
+		case 'V':
+			opts.version = optarg;
+			break;
+		case 'B':
+			opts.bootloader = true;
+			break;
+		case 'C':
+			opts.legacy_code = true;
+			break;
+		case 'r': {
+			auto tok = split(optarg, ',');
+			ram_images.push_back({ tok[0], tok.size() > 1 ? lexical_cast<uint32_t>(tok[1], 0) : 0x80000000 });
+			break;
+		}
+		case 'f':
+			flash_image = optarg;
+			break;
+		case 'b':
+			opts.rate = lexical_cast<unsigned>(optarg);
+			break;
+		case 'l':
+			opts.latency = lexical_cast<unsigned>(optarg);
+			break;
+		case 'n':
+			opts.drop = lexical_cast<double>(optarg);
+			break;
+		case 'c':
+			opts.corrupt = lexical_cast<double>(optarg);
+			break;
+		case 's':
+			opts.clients = max(lexical_cast<unsigned>(optarg), 1u);
+			break;
+		case 'S':
+			snmp_port = lexical_cast<uint16_t>(optarg);
+			break;
+		case 'v':
+			loglevel = max(loglevel - 1, logger::trace);
+			break;
+		case 'h':
+		default:
+			usage();
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (optind + 1 != argc) {
+		usage();
+		return 1;
+	}
+
+	logger::loglevel(loglevel);
+
+	device dev(opts);
+
+	for (auto img : ram_images) {
+		dev.ram().write(img.second, read_file(img.first));
+	}
+
+	if (!flash_image.empty()) {
+		dev.flash() = read_file(flash_image);
+	}
+
+	snmp_agent agent(dev, opts);
+
+	if (snmp_port) {
+		thread([&agent, snmp_port] {
+			try {
+				agent.serve(snmp_port);
+			} catch (const exception& e) {
+				logger::e() << "snmp: " << e.what() << endl;
+				exit(1);
+			}
+		}).detach();
+	}
+
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0) {
+		throw errno_error("socket");
+	}
+
+	int one = 1;
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = h_to_be(lexical_cast<uint16_t>(argv[optind]));
+	addr.sin_addr.s_addr = h_to_be(uint32_t(INADDR_LOOPBACK));
+
+	if (::bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+		throw errno_error("bind");
+	} else if (listen(sock, opts.clients) != 0) {
+		throw errno_error("listen");
+	}
+
+	logger::v() << "listening on 127.0.0.1:" << argv[optind] << endl;
+
+	mutex mtx;
+	condition_variable cv;
+	unsigned clients = 0;
+
+	while (true) {
+		{
+			unique_lock<mutex> lock(mtx);
+			cv.wait(lock, [&] { return clients < opts.clients; });
+		}
+
+		int fd = accept(sock, nullptr, nullptr);
+		if (fd < 0) {
+			throw errno_error("accept");
+		}
+
+		logger::v() << "client connected" << endl;
+
+		auto serve = [&, fd] {
+			try {
+				console con(fd, opts);
+				dev.serve(con);
+			} catch (const exception& e) {
+				logger::v() << e.what() << endl;
+			}
+
+			logger::v() << "client disconnected" << endl;
+		};
+
+		if (opts.clients == 1) {
+			serve();
+			continue;
+		}
+
+		lock_guard<mutex> lock(mtx);
+		++clients;
+
+		thread([&, serve] {
+			serve();
+			lock_guard<mutex> lock(mtx);
+			--clients;
+			cv.notify_all();
+		}).detach();
+	}
+}
+}
+
+int main(int argc, char** argv)
+{
+	try {
+		return do_main(argc, argv);
+	} catch (const exception& e) {
+		logger::e() << "error: " << e.what() << endl;
+		return 1;
+	}
+}
@@ -0,0 +1,201 @@
+/**
+ * bcm2-utils
+ * Copyright (C) 2016 Joseph Lehner <joseph.c.lehner@gmail.com>
+ *
+ * bcm2-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bcm2-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bcm2-utils.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef BCM2DUMP_HEXLINE_H
+#define BCM2DUMP_HEXLINE_H
+#include <cstdint>
+#include "util.h"
+
+// Parsers for the hexdump lines that make up most of the output we read
+// from a device. These are used instead of sscanf, split() and hex_cast,
+// since they run once per line, and neither allocate nor copy the line.
+
+namespace bcm2dump {
+namespace hexline {
+
+struct digit_table
+{
+	constexpr digit_table() : value()
+	{
+		for (unsigned i = 0; i < 256; ++i) {
+			value[i] = 0xff;
+		}
+
+		for (unsigned i = 0; i < 10; ++i) {
+			value['0' + i] = i;
+		}
+
+		for (unsigned i = 0; i < 6; ++i) {
+			value['a' + i] = value['A' + i] = 10 + i;
+		}
+	}
+
+	uint8_t value[256];
+};
+
+constexpr digit_table digits;
+
+inline bool is_space(char c)
+{
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+inline void skip_space(const char*& p, const char* end)
+{
+	while (p != end && is_space(*p)) {
+		++p;
+	}
+}
+
+// parses an unsigned number in base 16 or 10. on success, `p` is advanced
+// to the first character after the number. fails if there are no digits,
+// or if the number doesn't fit into 32 bits.
+template<unsigned Base> inline bool parse_num(const char*& p, const char* end, uint32_t& n)
+{
+	static_assert(Base == 10 || Base == 16, "unsupported base");
+
+	uint64_t val = 0;
+	const char* q = p;
+
+	for (; q != end; ++q) {
+		unsigned d = digits.value[uint8_t(*q)];
+		if (d >= Base) {
+			break;
+		} else if ((val = val * Base + d) > 0xffffffff) {
+			return false;
+		}
+	}
+
+	if (q == p) {
+		return false;
+	}
+
+	n = val;
+	p = q;
+	return true;
+}
+
+// parses a line like "<offset>: <word> <word> ...", storing up to `max` words.
+// like sscanf with "%x: %x  %x ...", it returns the number of numbers that were
+// parsed, including the offset.
+template<unsigned Base> int parse_dump_line(string_view line, uint32_t& offset, uint32_t* words, int max)
+{
+	const char* p = line.data();
+	const char* end = p + line.size();
+
+	skip_space(p, end);
+	if (!parse_num<Base>(p, end, offset)) {
+		return 0;
+	} else if (p == end || *p++ != ':') {
+		return 1;
+	}
+
+	int n = 1;
+
+	for (; n <= max; ++n) {
+		skip_space(p, end);
+		if (!parse_num<Base>(p, end, words[n - 1])) {
+			break;
+		}
+	}
+
+	return n;
+}
+
+// the line parsers of the rwx implementations. on failure, they return false,
+// and leave `chunk` untouched.
+
+// parses a line of bfc ram output, in hex, or in decimal if the firmware has
+// switched to an all-decimal format. the line's offset is stored in `line_offset`,
+// and its words are only appended to `chunk` if it matches `offset`.
+inline bool parse_bfc_ram_line(string_view line, uint32_t offset, uint32_t& line_offset, std::string& chunk)
+{
+	uint32_t words[4];
+
+	int n = parse_dump_line<16>(line, line_offset, words, 4);
+	if (n <= 1 || line_offset != offset) {
+		n = parse_dump_line<10>(line, line_offset, words, 4);
+	}
+
+	if (!n) {
+		return false;
+	} else if (line_offset == offset) {
+		for (int i = 0; i < (n - 1); ++i) {
+			append_buf(chunk, be_to_h(words[i]));
+		}
+	}
+
+	return true;
+}
+
+// parses a line of space-separated hex numbers, as printed by bfc flash reads.
+// these are either words, or bytes if `bytes` is set.
+inline bool parse_bfc_flash_line(string_view line, bool bytes, std::string& chunk)
+{
+	const char* p = line.data();
+	const char* end = p + line.size();
+	size_t size = chunk.size();
+
+	while (p != end) {
+		if (*p == ' ') {
+			++p;
+			continue;
+		}
+
+		uint32_t n;
+		if (!parse_num<16>(p, end, n) || (p != end && *p != ' ') || (bytes && n > 0xff)) {
+			chunk.resize(size);
+			return false;
+		}
+
+		if (bytes) {
+			chunk += char(n);
+		} else {
+			append_buf(chunk, be_to_h(n));
+		}
+	}
+
+	return chunk.size() != size;
+}
+
+// parses a line of colon-separated hex words, as printed by the dump code
+// (without the leading ':').
+inline bool parse_code_line(string_view line, std::string& chunk)
+{
+	const char* p = line.data();
+	const char* end = p + line.size();
+	size_t size = chunk.size();
+
+	while (true) {
+		uint32_t n;
+		if (!parse_num<16>(p, end, n) || (p != end && *p != ':')) {
+			chunk.resize(size);
+			return false;
+		}
+
+		append_buf(chunk, h_to_be(n));
+		if (p++ == end) {
+			return true;
+		}
+	}
+}
+}
+}
+
+#endif
@@ -19,7 +19,12 @@
 
 #include <sys/stat.h>
 #include <algorithm>
+#include <fcntl.h>
 #include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <mutex>
 #include <set>
 #include "interface.h"
 #include "rwx.h"
@@ -96,6 +101,243 @@ uint32_t get_max_magic_addr(const profile::sp& p, int intf_id)
 	return ret;
 }
 
+// coalesces nearby magics into blocks, so that a single read can be used
+// for several of them. returns a map of block begin -> end.
+map<uint32_t, uint32_t> get_magic_blocks(const vector<const bcm2_magic*>& magics)
+{
+	const uint32_t max_gap = 512;
+	const uint32_t max_block = 2048;
+
+	set<pair<uint32_t, uint32_t>> ranges;
+	for (auto m : magics) {
+		if (magic_size(m)) {
+			ranges.insert({ m->addr, m->addr + magic_size(m) });
+		}
+	}
+
+	map<uint32_t, uint32_t> blocks;
+
+	for (auto r : ranges) {
+		if (!blocks.empty()) {
+			auto& b = *blocks.rbegin();
+			if (r.first <= b.second + max_gap && max(r.second, b.second) - b.first <= max_block) {
+				b.second = max(b.second, r.second);
+				continue;
+			}
+		}
+
+		blocks[r.first] = r.second;
+	}
+
+	return blocks;
+}
+
+// remembers the profile and version of devices that we've connected to
+// before, so we can skip detection. entries are keyed by the interface type
+// and the connection (see interface::create), verified by reading magics,
+// and removed if that fails.
+class device_cache
+{
+	public:
+	struct entry
+	{
+		string profile;
+		string version;
+		// su password that worked last time. only built-in passwords
+		// are stored, so that user-supplied ones never end up on disk.
+		string su_password;
+	};
+
+	static bool get(const string& key, entry& e)
+	{
+		lock_guard<mutex> lock(s_mutex);
+		auto entries = load();
+		auto it = entries.find(key);
+		if (it == entries.end()) {
+			return false;
+		}
+
+		e = it->second;
+		return true;
+	}
+
+	static void put(const string& key, const entry& e)
+	{
+		lock_guard<mutex> lock(s_mutex);
+		auto entries = load();
+		entries[key] = e;
+		save(entries);
+	}
+
+	static void erase(const string& key)
+	{
+		lock_guard<mutex> lock(s_mutex);
+		auto entries = load();
+		if (entries.erase(key)) {
+			save(entries);
+		}
+	}
+
+	private:
+	static string dirname()
+	{
+#ifndef _WIN32
+		const char* dir = getenv("XDG_CACHE_HOME");
+		if (dir && *dir) {
+			return dir + "/bcm2dump"s;
+		}
+
+		dir = getenv("HOME");
+		return dir && *dir ? dir + "/.cache/bcm2dump"s : "";
+#else
+		const char* dir = getenv("LOCALAPPDATA");
+		return dir && *dir ? dir + "\\bcm2dump"s : "";
+#endif
+	}
+
+	static map<string, entry> load()
+	{
+		map<string, entry> entries;
+		ifstream in(dirname() + "/devices");
+		string line;
+
+		while (getline(in, line)) {
+			auto tok = split(line, '\t', true);
+			if (tok.size() == 3 || tok.size() == 4) {
+				entries[tok[0]] = { tok[1], tok[2], tok.size() == 4 ? tok[3] : "" };
+			}
+		}
+
+		return entries;
+	}
+
+	static void save(const map<string, entry>& entries)
+	{
+		string dir = dirname();
+		if (dir.empty()) {
+			return;
+		}
+
+		// create the parent directory too, if it's ~/.cache
+		for (auto d : { dir.substr(0, dir.rfind('/')), dir }) {
+#ifndef _WIN32
+			mkdir(d.c_str(), 0700);
+#else
+			mkdir(d.c_str());
+#endif
+		}
+
+		string tmp = dir + "/devices." + to_string(getpid());
+		{
+#ifndef _WIN32
+			// ofstream can't set the mode, so create the file first
+			int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+			if (fd < 0) {
+				logger::d() << "failed to create " << tmp << endl;
+				return;
+			}
+			close(fd);
+#endif
+
+			ofstream out(tmp);
+			for (auto& e : entries) {
+				out << e.first << '\t' << e.second.profile << '\t' << e.second.version
+						<< '\t' << e.second.su_password << '\n';
+			}
+
+			if (!out.good()) {
+				logger::d() << "failed to write " << tmp << endl;
+				return;
+			}
+		}
+
+		if (rename(tmp.c_str(), (dir + "/devices").c_str()) != 0) {
+			logger::d() << "failed to rename " << tmp << endl;
+			remove(tmp.c_str());
+		}
+	}
+
+	static mutex s_mutex;
+};
+
+mutex device_cache::s_mutex;
+
+bool is_usable_magic(const bcm2_magic* m)
+{
+	return m && magic_size(m) && m->addr;
+}
+
+// magics that are used to verify cached profiles: the version's magic, if
+// it has one, and the profile's magics, as long as all of them can be
+// read in a single block.
+vector<const bcm2_magic*> get_verification_magics(const profile::sp& p, const version& v)
+{
+	vector<const bcm2_magic*> ret;
+
+	if (v.raw() && is_usable_magic(v.magic())) {
+		ret.push_back(v.magic());
+	}
+
+	for (auto m : p->magics()) {
+		if (is_usable_magic(m)) {
+			ret.push_back(m);
+			if (get_magic_blocks(ret).size() > 1) {
+				ret.pop_back();
+			}
+		}
+	}
+
+	return ret;
+}
+
+bool detect_profile_from_cache(const interface::sp& intf, const string& key, device_cache::entry& e)
+{
+	if (key.empty() || !device_cache::get(key, e)) {
+		return false;
+	}
+
+	try {
+		auto p = profile::get(e.profile);
+		auto v = p->default_version(intf->id());
+
+		for (auto candidate : p->versions()) {
+			if (candidate.name() == e.version && (candidate.intf() & intf->id())) {
+				v = candidate;
+				break;
+			}
+		}
+
+		if (v.name() != e.version) {
+			throw runtime_error("no such version: " + e.version);
+		}
+
+		auto magics = get_verification_magics(p, v);
+		if (magics.empty()) {
+			throw runtime_error("no magic");
+		}
+
+		auto block = *get_magic_blocks(magics).begin();
+		string data = rwx::create(intf, "ram", true)->read(block.first, block.second - block.first);
+
+		for (auto m : magics) {
+			if (data.compare(m->addr - block.first, magic_size(m), magic_data(m))) {
+				throw runtime_error("magic mismatch at " + to_hex(m->addr));
+			}
+		}
+
+		intf->set_profile(p, v);
+		logger::d() << "using cached profile " << p->name() << " for " << key << endl;
+		return true;
+	} catch (const rwx::interrupted& e) {
+		throw;
+	} catch (const exception& ex) {
+		logger::v() << "invalidating cached profile " << e.profile << " for " << key
+				<< ": " << ex.what() << endl;
+		device_cache::erase(key);
+		return false;
+	}
+}
+
 set<string> get_all_su_passwords()
 {
 	set<string> ret;
@@ -138,7 +380,7 @@ class bfc : public cmdline_interface
 	virtual bool check_privileged();
 	virtual void detect_profile() override;
 	virtual void initialize_impl() override;
-	virtual bool is_crash_line(const string& line) const override;
+	virtual bool is_crash_line(string_view line) const override;
 	virtual bool check_for_prompt(const string& line) const override;
 
 	private:
@@ -201,12 +443,21 @@ void bfc::do_elevate_privileges()
 		return;
 	}
 
-	set<string> passwords;
+	vector<string> passwords;
 
 	if (m_version.has_opt("bfc:su_password")) {
-		passwords.insert(m_version.get_opt_str("bfc:su_password"));
+		passwords.push_back(m_version.get_opt_str("bfc:su_password"));
 	} else {
-		passwords = get_all_su_passwords();
+		// try the password that worked last time first
+		if (!m_su_password.empty()) {
+			passwords.push_back(m_su_password);
+		}
+
+		for (auto pw : get_all_su_passwords()) {
+			if (pw != m_su_password) {
+				passwords.push_back(pw);
+			}
+		}
 	}
 
 	for (auto pw : passwords) {
@@ -219,6 +470,7 @@ void bfc::do_elevate_privileges()
 				logger::v() << "su password is '" << pw << "'" << endl;
 			}
 
+			m_su_password = pw;
 			return;
 		}
 	}
@@ -306,7 +558,7 @@ void bfc::initialize_impl()
 	run("/cm_hal/scan_stop");
 }
 
-bool bfc::is_crash_line(const string& line) const
+bool bfc::is_crash_line(string_view line) const
 {
 	return starts_with(line, "******************** CRASH")
 		|| starts_with(line, ">>> YIKES... ");
@@ -325,7 +577,7 @@ class bootloader : public cmdline_interface
 
 	protected:
 	virtual void call(const string& cmd) override;
-	virtual bool is_crash_line(const string& line) const override;
+	virtual bool is_crash_line(string_view line) const override;
 	virtual bool check_for_prompt(const string& line) const override;
 };
 
@@ -356,7 +608,7 @@ void bootloader::call(const string& cmd)
 }
 
 
-bool bootloader::is_crash_line(const string& line) const
+bool bootloader::is_crash_line(string_view line) const
 {
 	return starts_with(line, "******************** CRASH");
 }
@@ -627,9 +879,47 @@ void detect_profile_from_magics(const interface::sp& intf, const profile::sp& pr
 		}
 	}
 
+	// blocks are only read once they're needed, and never past the highest
+	// magic address of the profile that is being tested, so the order above
+	// is preserved.
+
+	map<uint32_t, uint32_t> blocks;
+
+	{
+		vector<const bcm2_magic*> all;
+		for (const helper& h : magics) {
+			all.push_back(h.m);
+		}
+
+		blocks = get_magic_blocks(all);
+	}
+
+	// block begin -> data read so far
+	map<uint32_t, string> cache;
+	unsigned reads = 0;
+
+	auto read_magic = [&] (const helper& h, uint32_t length) {
+		if (!length) {
+			return ram->read(h.m->addr, 0);
+		}
+
+		auto b = prev(blocks.upper_bound(h.m->addr));
+		string& buf = cache[b->first];
+		uint32_t end = h.m->addr + length;
+
+		if (b->first + buf.size() < end) {
+			uint32_t beg = b->first + buf.size();
+			buf += ram->read(beg, min(b->second, max(end, h.x + 1)) - beg);
+			++reads;
+		}
+
+		return buf.substr(h.m->addr - b->first, length);
+	};
+
 	for (const helper& h : magics) {
 		string data = magic_data(h.m);
-		if (ram->read(h.m->addr, data.size()) == data) {
+		if (read_magic(h, data.size()) == data) {
+			logger::d() << "magic probe: " << reads << " read(s)" << endl;
 			version v = h.v;
 
 			if (v.name().empty()) {
@@ -640,18 +930,24 @@ void detect_profile_from_magics(const interface::sp& intf, const profile::sp& pr
 			return;
 		}
 	}
+
+	logger::d() << "magic probe: " << reads << " read(s), no match" << endl;
 }
 }
 
 bool cmdline_interface::wait_ready(unsigned timeout)
 {
+	mstimer t;
 	call("");
-	return foreach_line_raw([this] (const string& line) {
+	bool ret = foreach_line_raw([this] (const string& line) {
 		if (!check_for_prompt(line)) {
 			return false;
 		}
 		return true;
 	}, timeout);
+
+	m_wait_ready_stats.add(t.elapsed_us());
+	return ret;
 }
 
 bool cmdline_interface::wait_quiet(unsigned timeout) const
@@ -693,20 +989,27 @@ vector<string> cmdline_interface::run(const string& cmd, unsigned timeout)
 }
 
 bool cmdline_interface::foreach_line_raw(function<bool(const string&)> f, unsigned timeout, bool restart) const
+{
+	return foreach_line_view([&f] (string_view line) {
+		return f(line.to_string());
+	}, timeout, restart);
+}
+
+bool cmdline_interface::foreach_line_view(function<bool(string_view)> f, unsigned timeout, bool restart) const
 {
 	mstimer t;
 
 	while (true) {
-		string line;
+		string_view line;
 		if (timeout) {
 			auto remaining = timeout - t.elapsed();
 			if (remaining < 0) {
 				break;
 			}
 
-			line = readln(remaining);
+			line = readln_view(remaining);
 		} else {
-			line = readln();
+			line = readln_view();
 		}
 
 		if (line.empty()) {
@@ -740,9 +1043,9 @@ bool cmdline_interface::foreach_line(function<bool(const string&)> f, unsigned t
 	return stopped ? (!prompt) : false;
 }
 
-string cmdline_interface::readln(unsigned timeout) const
+string_view cmdline_interface::readln_view(unsigned timeout) const
 {
-	string line = m_io->readln(timeout ? timeout : this->timeout());
+	string_view line = m_io->readln_view(timeout ? timeout : this->timeout());
 
 	if (is_crash_line(line)) {
 		// consume lines to fill the io log
@@ -758,12 +1061,26 @@ void interface::initialize(const profile::sp& profile)
 {
 	m_profile = profile;
 
-	if (!m_profile) {
+	string key = !m_profile ? m_cache_key : "";
+	device_cache::entry cached;
+	bool from_cache = detect_profile_from_cache(shared_from_this(), key, cached);
+
+	if (from_cache) {
+		m_su_password = cached.su_password;
+	} else if (!m_profile) {
 		detect_profile_from_magics(shared_from_this(), m_profile);
 	}
 
 	elevate_privileges();
 
+	if (from_cache && !cached.su_password.empty() && !is_privileged()) {
+		logger::v() << "invalidating cached profile " << cached.profile << " for " << key
+				<< ": failed to switch to super-user" << endl;
+		device_cache::erase(key);
+		from_cache = false;
+		key.clear();
+	}
+
 	if (!m_profile) {
 		detect_profile();
 	}
@@ -778,6 +1095,17 @@ void interface::initialize(const profile::sp& profile)
 			m_version = m_profile->default_version(id());
 		}
 		logger::i() << endl;
+
+		device_cache::entry e = { m_profile->name(), m_version.name(), "" };
+		if (!m_su_password.empty() && get_all_su_passwords().count(m_su_password)) {
+			e.su_password = m_su_password;
+		}
+
+		bool changed = !from_cache || e.su_password != cached.su_password;
+
+		if (changed && !key.empty() && !get_verification_magics(m_profile, m_version).empty()) {
+			device_cache::put(key, e);
+		}
 	}
 
 	initialize_impl();
@@ -790,7 +1118,26 @@ interface::sp interface::detect(const io::sp& io, const profile::sp& profile)
 	return intf;
 }
 
+namespace {
+string trace_file;
+}
+
+void interface::set_trace_file(const string& filename)
+{
+	trace_file = filename;
+}
+
+string interface::get_trace_file()
+{
+	return trace_file;
+}
+
 interface::sp interface::create(const string& spec, const string& profile_name)
+{
+	return create(spec, profile_name, nullptr);
+}
+
+interface::sp interface::create(const string& spec, const string& profile_name, const io::sp& replay)
 {
 	profile::sp profile;
 	if (!profile_name.empty()) {
@@ -818,15 +1165,43 @@ interface::sp interface::create(const string& spec, const string& profile_name)
 		}
 	}
 
+	auto open = [&spec, &replay] (function<io::sp()> f) {
+		if (replay) {
+			return replay;
+		}
+
+		io::sp io = f();
+		return trace_file.empty() ? io : io::record(io, trace_file, spec);
+	};
+
+	// the profile cache would break replaying traces
+	bool use_cache = !replay && trace_file.empty();
+
+	// identifies the device, without having to read anything from it
+	auto cache_key = [&] (const interface::sp& intf, const string& conn) {
+		return use_cache ? intf->name() + ":" + type + ":" + conn : "";
+	};
+
+	auto detect = [&] (const io::sp& io, const string& conn) {
+		interface::sp intf = detect_interface(io);
+		intf->m_cache_key = cache_key(intf, conn);
+		intf->initialize(profile);
+		return intf;
+	};
+
 	try {
 		if (type == "serial") {
 			unsigned speed = tokens.size() == 2 ? lexical_cast<unsigned>(tokens[1]) : 115200;
-			return detect(io::open_serial(tokens[0].c_str(), speed), profile);
+			return detect(open([&] { return io::open_serial(tokens[0].c_str(), speed); }), tokens[0]);
 		} else if (type == "tcp") {
-			return detect(io::open_tcp(tokens[0], lexical_cast<uint16_t>(tokens[1])), profile);
+			return detect(open([&] {
+				return io::open_tcp(tokens[0], lexical_cast<uint16_t>(tokens[1]));
+			}), tokens[0] + "," + tokens[1]);
 		} else if (type == "telnet") {
 			uint16_t port = tokens.size() == 4 ? lexical_cast<uint16_t>(tokens[3]) : 23;
-			interface::sp intf = detect_interface(io::open_telnet(tokens[0], port));
+			interface::sp intf = detect_interface(open([&] { return io::open_telnet(tokens[0], port); }));
+			// the credentials are not part of the key
+			intf->m_cache_key = cache_key(intf, tokens[0] + "," + to_string(port));
 
 			// this is UGLY, but it should never fail
 			telnet* t = dynamic_cast<telnet*>(intf.get());
@@ -840,6 +1215,12 @@ interface::sp interface::create(const string& spec, const string& profile_name)
 
 			intf->initialize(profile);
 			return intf;
+		} else if (type == "replay" && !replay) {
+			double speed = tokens.size() == 2 ? lexical_cast<double>(tokens[1]) : 1.0;
+			string recorded;
+			io::sp io = io::open_replay(tokens[0], speed, recorded);
+			logger::v() << "replaying " << recorded << " from " << tokens[0] << endl;
+			return create(recorded, profile_name, io);
 		} else if (type == "snmp") {
 #ifdef BCM2DUMP_WITH_SNMP
 			auto intf = snmp::detect(tokens[0]);
@@ -69,10 +69,15 @@ class interface : public std::enable_shared_from_this<interface>
 
 	static interface::sp detect(const io::sp& io, const profile::sp& sp = nullptr);
 	static interface::sp create(const std::string& specl, const std::string& profile = "");
+	// record the i/o of all subsequently created interfaces to `filename`
+	static void set_trace_file(const std::string& filename);
+	static std::string get_trace_file();
 
 	virtual bcm2_interface id() const = 0;
 
 	protected:
+	static interface::sp create(const std::string& spec, const std::string& profile, const io::sp& replay);
+
 	void initialize(const profile::sp& profile);
 
 	virtual void initialize_impl()
@@ -87,6 +92,10 @@ class interface : public std::enable_shared_from_this<interface>
 	protected:
 	profile::sp m_profile;
 	version_type m_version;
+	// key of this device in the profile cache, if it is to be used
+	std::string m_cache_key;
+	// bfc su password that worked for this device
+	std::string m_su_password;
 };
 
 class cmdline_interface : public interface
@@ -99,6 +108,10 @@ class cmdline_interface : public interface
 	virtual bool wait_ready(unsigned timeout = 5000);
 	virtual bool wait_quiet(unsigned timeout = 500) const;
 
+	// time spent in wait_ready(), in microseconds
+	const histogram& wait_ready_stats() const
+	{ return m_wait_ready_stats; }
+
 	virtual bool is_active()
 	{ return is_ready(false); }
 
@@ -116,13 +129,21 @@ class cmdline_interface : public interface
 	virtual void writeln(const std::string& str = "")
 	{ m_io->writeln(str); }
 
+	virtual void writeln_nowait(const std::string& str = "")
+	{ m_io->writeln_nowait(str); }
+
 	virtual void write(const std::string& str)
 	{ m_io->write(str); }
 
 	bool foreach_line_raw(std::function<bool(const std::string&)> f, unsigned timeout = 0, bool restart = false) const;
+	// like foreach_line_raw, but `f` receives a view that is only valid during the call
+	bool foreach_line_view(std::function<bool(string_view)> f, unsigned timeout = 0, bool restart = false) const;
 	bool foreach_line(std::function<bool(const std::string&)> f, unsigned timeout = 0) const;
 
-	virtual std::string readln(unsigned timeout = 0) const;
+	std::string readln(unsigned timeout = 0) const
+	{ return readln_view(timeout).to_string(); }
+
+	virtual string_view readln_view(unsigned timeout = 0) const;
 
 	virtual bool pending(unsigned timeout = 0) const
 	{ return m_io->pending(timeout ? timeout : this->timeout()); }
@@ -131,7 +152,7 @@ class cmdline_interface : public interface
 	virtual void call(const std::string& cmd)
 	{ writeln(cmd); }
 
-	virtual bool is_crash_line(const std::string& line) const
+	virtual bool is_crash_line(string_view line) const
 	{ return false; }
 
 	virtual bool check_for_prompt(const std::string& line) const = 0;
@@ -140,6 +161,7 @@ class cmdline_interface : public interface
 	{ return 50; }
 
 	std::shared_ptr<io> m_io;
+	histogram m_wait_ready_stats;
 };
 
 }
@@ -18,6 +18,10 @@
  */
 
 #include <system_error>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <fstream>
 #include <sys/types.h>
 #include <stdexcept>
 #include <fcntl.h>
@@ -87,8 +91,12 @@ class scoped_nonblock
 
 ssize_t recv_dontwait(int fd, char* buf, size_t len, int flags = 0)
 {
+#ifndef _WIN32
+	return recv(fd, buf, len, flags | MSG_DONTWAIT);
+#else
 	scoped_nonblock f(fd);
 	return recv(fd, buf, len, flags);
+#endif
 }
 
 ssize_t send_nosignal(int fd, const char* buf, size_t len, int flags = 0)
@@ -198,19 +206,33 @@ class fdio : public io
 {
 	public:
 	fdio() : m_fd(-1) {}
-
-	virtual ~fdio()
-	{ ::close(m_fd); }
+	virtual ~fdio();
 
 	virtual bool pending(unsigned timeout) override;
 	virtual void write(const string& str) override;
 	virtual string read(size_t length, bool partial = true) override;
+	virtual string_view readln_view(unsigned timeout = 0) override;
+	virtual string readln(unsigned timeout = 0) override
+	{ return readln_view(timeout).to_string(); }
 
 	protected:
 	virtual int getc() override;
-	virtual ssize_t read1(char &c);
+	// a single read(2) call (or equivalent)
+	virtual ssize_t read_some(char* buf, size_t len);
+	// filters received data in-place, returning the new length
+	virtual size_t filter(char* buf, size_t len)
+	{ return len; }
+	// appends to the receive buffer; returns false
+	// if no data is available
+	bool fill();
+	bool poll(unsigned timeout);
 
 	int m_fd;
+
+	private:
+	char m_rxbuf[16384];
+	size_t m_rxbeg = 0;
+	size_t m_rxend = 0;
 };
 
 #if defined(_WIN32)
@@ -244,6 +266,8 @@ class serial :
 	serial(const char* tty, unsigned speed);
 	virtual ~serial() {}
 	virtual void writeln(const string& str) override;
+	virtual void writeln_nowait(const string& str) override
+	{ write(str + "\r\n"); }
 #ifndef _WIN32
 	virtual void write(const string& str) override;
 #else
@@ -259,10 +283,9 @@ class tcp : public fdio
 	virtual void write(const string& str) override;
 	virtual void writeln(const string& str) override
 	{ write(str + "\r\n"); }
-	virtual string read(size_t length, bool partial = true) override;
 
 	protected:
-	virtual ssize_t read1(char& c) override;
+	virtual ssize_t read_some(char* buf, size_t len) override;
 };
 
 class telnet : public tcp
@@ -271,9 +294,11 @@ class telnet : public tcp
 	telnet(const string& addr, uint16_t port) : tcp(addr, port) {}
 	virtual void write(const string& str) override;
 	virtual void writeln(const string& str) override;
+	virtual void writeln_nowait(const string& str) override
+	{ write(str + "\r"); }
 
 	protected:
-	virtual int getc() override;
+	virtual size_t filter(char* buf, size_t len) override;
 
 	private:
 	void handle_op_opt(int op, int opt);
@@ -290,10 +315,32 @@ class telnet : public tcp
 #endif
 	static int constexpr op_will = 251;
 	static int constexpr op_dont = 254;
+
+	// 0 = data, 1 = after IAC, 2 = after IAC + command
+	int m_state = 0;
+	int m_cmd = 0;
 };
 
+fdio::~fdio()
+{
+	::close(m_fd);
+
+	if (m_stats.rx_bytes) {
+		logger::d() << "io: received " << m_stats.rx_bytes << " b in " << m_stats.rx_calls << " reads, "
+				<< m_stats.rx_polls << " polls (" << double(m_stats.rx_calls + m_stats.rx_polls) / m_stats.rx_bytes
+				<< " syscalls/b); sent " << m_stats.tx_bytes << " b in " << m_stats.tx_calls << " writes" << endl;
+	}
+}
+
 bool fdio::pending(unsigned timeout)
 {
+	return m_rxbeg != m_rxend || poll(timeout);
+}
+
+bool fdio::poll(unsigned timeout)
+{
+	++m_stats.rx_polls;
+
 	fd_set fds;
 	FD_ZERO(&fds);
 	FD_SET(m_fd, &fds);
@@ -318,39 +365,135 @@ bool fdio::pending(unsigned timeout)
 
 int fdio::getc()
 {
-	char c;
-	ssize_t ret = read1(c);
-	if (ret == 1) {
-		return c & 0xff;
+	if (m_rxbeg == m_rxend) {
+		if (!fill()) {
+			return eof;
+		} else if (m_rxbeg == m_rxend) {
+			// everything was filtered
+			return ign;
+		}
+	}
+
+	return m_rxbuf[m_rxbeg++] & 0xff;
+}
+
+bool fdio::fill()
+{
+	if (m_rxbeg == m_rxend) {
+		m_rxbeg = m_rxend = 0;
+	} else if (m_rxbeg) {
+		memmove(m_rxbuf, m_rxbuf + m_rxbeg, m_rxend - m_rxbeg);
+		m_rxend -= m_rxbeg;
+		m_rxbeg = 0;
+	}
+
+	if (m_rxend == sizeof(m_rxbuf)) {
+		return false;
+	}
+
+	ssize_t ret = read_some(m_rxbuf + m_rxend, sizeof(m_rxbuf) - m_rxend);
+	++m_stats.rx_calls;
+
+	if (ret > 0) {
+		m_stats.rx_bytes += ret;
+		m_rxend += filter(m_rxbuf + m_rxend, ret);
+		return true;
 	} else if (!ret || errno == EWOULDBLOCK || errno == EAGAIN) {
-		return eof;
+		return false;
 	} else {
-		throw errno_error("read1");
+		throw errno_error("read");
 	}
 }
 
-ssize_t fdio::read1(char& c)
+ssize_t fdio::read_some(char* buf, size_t len)
 {
-	return ::read(m_fd, &c, 1);
+	return ::read(m_fd, buf, len);
 }
 
 string fdio::read(size_t length, bool all)
 {
-	string buf(length, '\0');
-	ssize_t read = ::read(m_fd, &buf[0], length);
-	if (read < 0 || (all && read < length)) {
-		throw errno_error("read");
+	size_t n = min(length, m_rxend - m_rxbeg);
+	string buf(m_rxbuf + m_rxbeg, n);
+	m_rxbeg += n;
+
+	if (n < length) {
+		buf.resize(length);
+		ssize_t read = read_some(&buf[n], length - n);
+		++m_stats.rx_calls;
+
+		if (read < 0 && (errno == EWOULDBLOCK || errno == EAGAIN) && !all) {
+			read = 0;
+		} else if (read < 0 || (all && (n + read) < length)) {
+			throw errno_error("read");
+		}
+
+		m_stats.rx_bytes += read;
+		buf.resize(n + filter(&buf[n], read));
 	}
 
-	buf.resize(read);
 	return buf;
 }
 
+string_view fdio::readln_view(unsigned timeout)
+{
+	size_t scanned = 0;
+	char* nl;
+
+	while (!(nl = static_cast<char*>(memchr(m_rxbuf + m_rxbeg + scanned, '\n', m_rxend - m_rxbeg - scanned)))) {
+		scanned = m_rxend - m_rxbeg;
+		if (!poll(timeout) || !fill()) {
+			break;
+		}
+	}
+
+	char* beg = m_rxbuf + m_rxbeg;
+	char* end = nl ? nl : (m_rxbuf + m_rxend);
+	m_rxbeg = (end - m_rxbuf) + (nl ? 1 : 0);
+
+	// a carriage return moves the cursor to the beginning of the
+	// line, without erasing it. since we'll never write past the
+	// current read position, this can be done in-place.
+
+	size_t i = 0, len = 0;
+	bool cr = false;
+
+	for (char* p = beg; p != end; ++p) {
+		if (*p == '\r') {
+			cr = true;
+		} else {
+			if (cr) {
+				i = 0;
+				cr = false;
+			}
+
+			beg[i++] = *p;
+			len = max(len, i);
+		}
+	}
+
+	string_view line(beg, len);
+
+	if (!line.empty()) {
+#ifdef DEBUG
+		logger::log_io(line, true);
+#endif
+		return line;
+	} else if (nl) {
+#ifdef DEBUG
+		logger::log_io("", true);
+#endif
+	}
+
+	return nl ? string_view("\0", 1) : string_view();
+}
+
 void fdio::write(const string& str)
 {
+	++m_stats.tx_calls;
 	if (::write(m_fd, str.data(), str.size()) != str.size()) {
 		throw errno_error("write");
 	}
+	m_stats.tx_bytes += str.size();
 #ifdef DEBUG
 	logger::log_io(str, false);
 #endif
@@ -368,7 +511,7 @@ void serial::write(const string& str)
 
 void serial::writeln(const string& str)
 {
-	write(str + "\r\n");
+	writeln_nowait(str);
 	// consume the line we've just written
 	readln(100);
 }
@@ -576,29 +719,19 @@ tcp::tcp(const string& addr, uint16_t port)
 
 void tcp::write(const string& str)
 {
+	++m_stats.tx_calls;
 	if (send_nosignal(m_fd, str.data(), str.size()) != str.size()) {
 		throw errno_error("send");
 	}
+	m_stats.tx_bytes += str.size();
 	#ifdef DEBUG
 	logger::log_io(str, false);
 	#endif
 }
 
-ssize_t tcp::read1(char& c)
-{
-	return recv_dontwait(m_fd, &c, 1);
-}
-
-string tcp::read(size_t length, bool all)
+ssize_t tcp::read_some(char* buf, size_t len)
 {
-	string buf(length, '\0');
-	ssize_t read = recv(m_fd, &buf[0], length, MSG_DONTWAIT);
-	if (read < 0 || (all && read < length)) {
-		throw errno_error("read");
-	}
-
-	buf.resize(read);
-	return buf;
+	return recv_dontwait(m_fd, buf, len);
 }
 
 void telnet::write(const string& str)
@@ -633,29 +766,42 @@ void telnet::write(const string& str)
 
 void telnet::writeln(const string& str)
 {
-	write(str + "\r");
+	writeln_nowait(str);
 	readln(200);
 }
 
-int telnet::getc()
+size_t telnet::filter(char* buf, size_t len)
 {
-	int c = tcp::getc();
-	if (c == 0xff) {
-		c = tcp::getc();
-		if (c < 0xff) {
-			int opt = tcp::getc();
-			logger::d() << "telnet: received command " << c << "," << opt << endl;
-			if (c >= op_will && c <= op_dont) {
-				//logger::d() << "telnet: handling command " << c << "," << opt << endl;
-				//handle_op_opt(c, opt);
+	size_t k = 0;
+
+	for (size_t i = 0; i < len; ++i) {
+		int c = buf[i] & 0xff;
+
+		if (m_state == 1) {
+			if (c == 0xff) {
+				buf[k++] = c;
+				m_state = 0;
 			} else {
-				//logger::d() << "telnet: not handling command " << c << "," << opt << endl;
+				m_cmd = c;
+				m_state = 2;
 			}
-			return ign;
+		} else if (m_state == 2) {
+			logger::d() << "telnet: received command " << m_cmd << "," << c << endl;
+			if (m_cmd >= op_will && m_cmd <= op_dont) {
+				//logger::d() << "telnet: handling command " << m_cmd << "," << c << endl;
+				//handle_op_opt(m_cmd, c);
+			} else {
+				//logger::d() << "telnet: not handling command " << m_cmd << "," << c << endl;
+			}
+			m_state = 0;
+		} else if (c == 0xff) {
+			m_state = 1;
+		} else if (c) {
+			buf[k++] = c;
 		}
 	}
 
-	return c ? c : ign;
+	return k;
 }
 
 // the bfc telnet server sends the following
@@ -669,6 +815,233 @@ int telnet::getc()
 // and echo, and try to fend off everything else
 //
 
+// trace file format (all numbers are big-endian):
+//
+// "BCM2TRC1"
+// u16    spec length
+// char[] spec
+//
+// followed by records:
+//
+// u8     operation (see below)
+// u32    time spent in the call, in microseconds
+// u32    data length
+// char[] data
+//
+// for writes, the data is what was written; for reads, what was returned.
+
+const char trace_magic[] = "BCM2TRC1";
+
+enum trace_op : uint8_t
+{
+	op_pending = 'P',
+	op_getc = 'G',
+	op_readln = 'L',
+	op_read = 'R',
+	op_write = 'W',
+	op_writeln = 'N',
+	op_writeln_nowait = 'n',
+};
+
+class recorder : public io
+{
+	public:
+	recorder(const io::sp& io, const string& filename, const string& spec)
+	: m_io(io), m_os(filename, ios::binary)
+	{
+		if (!m_os.good()) {
+			throw user_error("failed to open " + filename + " for writing");
+		}
+
+		m_os.write(trace_magic, 8);
+		m_os.write(to_buf(h_to_be(uint16_t(spec.size()))).data(), 2);
+		m_os.write(spec.data(), spec.size());
+	}
+
+	virtual int getc() override
+	{
+		auto t = now();
+		int c = call([&] { return m_io->getc(); });
+		record(op_getc, t, to_buf(h_to_be(uint32_t(c))));
+		return c;
+	}
+
+	virtual string readln(unsigned timeout) override
+	{ return readln_view(timeout).to_string(); }
+
+	virtual string_view readln_view(unsigned timeout) override
+	{
+		auto t = now();
+		auto line = call([&] { return m_io->readln_view(timeout); });
+		record(op_readln, t, line);
+		return line;
+	}
+
+	virtual string read(size_t length, bool partial) override
+	{
+		auto t = now();
+		auto buf = call([&] { return m_io->read(length, partial); });
+		record(op_read, t, buf);
+		return buf;
+	}
+
+	virtual void writeln(const string& buf) override
+	{
+		auto t = now();
+		call([&] { m_io->writeln(buf); });
+		record(op_writeln, t, buf);
+	}
+
+	virtual void writeln_nowait(const string& buf) override
+	{
+		auto t = now();
+		call([&] { m_io->writeln_nowait(buf); });
+		record(op_writeln_nowait, t, buf);
+	}
+
+	virtual void write(const string& buf) override
+	{
+		auto t = now();
+		call([&] { m_io->write(buf); });
+		record(op_write, t, buf);
+	}
+
+	virtual bool pending(unsigned timeout) override
+	{
+		auto t = now();
+		bool ret = call([&] { return m_io->pending(timeout); });
+		record(op_pending, t, ret ? "\x01" : "\x00"s);
+		return ret;
+	}
+
+	virtual const stats& get_stats() const override
+	{ return m_io->get_stats(); }
+
+	private:
+	typedef chrono::steady_clock clock;
+
+	static clock::time_point now()
+	{ return clock::now(); }
+
+	// the trace is buffered, but whatever led up to an error must not
+	// be lost if the caller ends up exiting.
+	template<class F> auto call(F f) -> decltype(f())
+	{
+		try {
+			return f();
+		} catch (...) {
+			m_os.flush();
+			throw;
+		}
+	}
+
+	void record(trace_op op, clock::time_point start, string_view data)
+	{
+		auto us = chrono::duration_cast<chrono::microseconds>(now() - start).count();
+
+		string buf(1, char(op));
+		append_buf(buf, h_to_be(uint32_t(min<decltype(us)>(us, UINT32_MAX))));
+		append_buf(buf, h_to_be(uint32_t(data.size())));
+		buf.append(data.data(), data.size());
+
+		m_os.write(buf.data(), buf.size());
+	}
+
+	io::sp m_io;
+	ofstream m_os;
+};
+
+class replay : public io
+{
+	public:
+	replay(const string& filename, double speed, string& spec)
+	: m_is(filename, ios::binary), m_speed(speed)
+	{
+		if (!m_is.good()) {
+			throw user_error("failed to open " + filename + " for reading");
+		}
+
+		if (read_raw(8) != string(trace_magic, 8)) {
+			throw user_error(filename + ": not a trace file");
+		}
+
+		spec = read_raw(be_to_h(extract<uint16_t>(read_raw(2))));
+	}
+
+	virtual int getc() override
+	{ return be_to_h(extract<uint32_t>(next(op_getc))); }
+
+	virtual string readln(unsigned timeout) override
+	{ return next(op_readln); }
+
+	virtual string_view readln_view(unsigned timeout) override
+	{
+		m_line = next(op_readln);
+		return m_line;
+	}
+
+	virtual string read(size_t length, bool partial) override
+	{ return next(op_read); }
+
+	virtual void writeln(const string& buf) override
+	{ check(op_writeln, buf); }
+
+	virtual void writeln_nowait(const string& buf) override
+	{ check(op_writeln_nowait, buf); }
+
+	virtual void write(const string& buf) override
+	{ check(op_write, buf); }
+
+	virtual bool pending(unsigned timeout) override
+	{ return next(op_pending) != "\x00"s; }
+
+	private:
+	string read_raw(size_t length)
+	{
+		string buf(length, '\0');
+		if (!m_is.read(&buf[0], length)) {
+			throw runtime_error("unexpected end of trace");
+		}
+		return buf;
+	}
+
+	string next(trace_op op)
+	{
+		if (m_is.peek() == char_traits<char>::eof()) {
+			throw runtime_error("end of trace");
+		}
+
+		char actual = read_raw(1)[0];
+		if (actual != op) {
+			throw runtime_error("trace diverged at record " + to_string(m_record) + ": expected '"
+					+ string(1, op) + "', got '" + string(1, actual) + "'");
+		}
+
+		++m_record;
+
+		auto us = be_to_h(extract<uint32_t>(read_raw(4)));
+		auto data = read_raw(be_to_h(extract<uint32_t>(read_raw(4))));
+
+		if (m_speed > 0) {
+			this_thread::sleep_for(chrono::microseconds(uint64_t(us / m_speed)));
+		}
+
+		return data;
+	}
+
+	void check(trace_op op, const string& buf)
+	{
+		if (next(op) != buf) {
+			logger::d() << "replay: record " << m_record << " differs from trace" << endl;
+		}
+	}
+
+	ifstream m_is;
+	double m_speed;
+	unsigned m_record = 0;
+	string m_line;
+};
+
 #if 0
 void telnet::handle_op_opt(int op, int opt)
 {
@@ -742,6 +1115,12 @@ string io::readln(unsigned timeout)
 	return lf ? string("\0", 1) : "";
 }
 
+string_view io::readln_view(unsigned timeout)
+{
+	m_line = readln(timeout);
+	return m_line;
+}
+
 shared_ptr<io> io::open_telnet(const string& address, unsigned short port)
 {
 	return make_shared<telnet>(address, port);
@@ -756,4 +1135,14 @@ shared_ptr<io> io::open_serial(const char* tty, unsigned speed)
 {
 	return make_shared<serial>(tty, speed);
 }
+
+shared_ptr<io> io::record(const sp& io, const string& filename, const string& spec)
+{
+	return make_shared<recorder>(io, filename, spec);
+}
+
+shared_ptr<io> io::open_replay(const string& filename, double speed, string& spec)
+{
+	return make_shared<replay>(filename, speed, spec);
+}
 }
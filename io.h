@@ -19,9 +19,11 @@
 
 #ifndef BCM2DUMP_IO_H
 #define BCM2DUMP_IO_H
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <list>
+#include "util.h"
 
 namespace bcm2dump {
 
@@ -34,19 +36,54 @@ class io
 	static constexpr int ign = 0x101;
 
 	typedef std::shared_ptr<io> sp;
+
+	struct stats
+	{
+		// number of read(2)/recv(2) calls
+		uint64_t rx_calls = 0;
+		// number of select(2) calls
+		uint64_t rx_polls = 0;
+		uint64_t rx_bytes = 0;
+		// number of write(2)/send(2) calls
+		uint64_t tx_calls = 0;
+		uint64_t tx_bytes = 0;
+	};
+
 	virtual ~io() {}
 
 	virtual int getc() = 0;
 	virtual std::string readln(unsigned timeout = 0);
+	// like readln(), but the returned view is only valid until the next
+	// read operation. implementations may return a view into the receive
+	// buffer.
+	virtual string_view readln_view(unsigned timeout = 0);
 	virtual std::string read(size_t length, bool partial = true) = 0;
 	virtual void writeln(const std::string& buf = "") = 0;
+	// like writeln(), but never consumes the echo
+	virtual void writeln_nowait(const std::string& buf = "")
+	{ writeln(buf); }
 	virtual void write(const std::string& buf) = 0;
 
 	virtual bool pending(unsigned timeout = 100) = 0;
 
+	virtual const stats& get_stats() const
+	{ return m_stats; }
+
 	static sp open_serial(const char* tty, unsigned speed);
 	static sp open_telnet(const std::string& address, uint16_t port);
 	static sp open_tcp(const std::string& address, uint16_t port);
+	// records all calls to `io`, and their results, to a trace file. `spec`
+	// is the interface specification that was used to create `io`.
+	static sp record(const sp& io, const std::string& filename, const std::string& spec);
+	// replays a trace file created by record(), with the original timing
+	// multiplied by `1/speed`. if speed is 0, all delays are skipped.
+	static sp open_replay(const std::string& filename, double speed, std::string& spec);
+
+	protected:
+	stats m_stats;
+
+	private:
+	std::string m_line;
 };
 }
 
@@ -21,6 +21,7 @@
 #include <iostream>
 #include <cstring>
 #include <cctype>
+#include <mutex>
 #include <set>
 #include "profile.h"
 #include "util.h"
@@ -30,6 +31,11 @@ using namespace std;
 namespace bcm2dump {
 namespace {
 
+// set_opt_overrides may replace s_overrides at any time, so values must
+// be copied while holding the lock.
+mutex overrides_mutex;
+once_flag profiles_once;
+
 template<class T> constexpr size_t array_size(const T array)
 {
 	return sizeof(array) / sizeof(array[0]);
@@ -416,22 +422,32 @@ do { \
 	}
 }
 
-const bcm2_typed_val* version::get_opt(const string& name, bcm2_type type) const
+bool version::get_opt(const string& name, bcm2_type type, bcm2_typed_val& val) const
 {
 	const bcm2_typed_val* ret = nullptr;
 
-	auto it = profile::s_overrides.find(name);
-	if (it != profile::s_overrides.end()) {
-		ret = &(it->second);
-	} else {
-		ret = get_version_opt(m_p, name, BCM2_TYPE_NIL);
+	{
+		lock_guard<mutex> lock(overrides_mutex);
+		auto it = profile::s_overrides.find(name);
+		if (it != profile::s_overrides.end()) {
+			if (it->second.type == type || type == BCM2_TYPE_NIL) {
+				val = it->second;
+				return true;
+			}
+		} else {
+			ret = get_version_opt(m_p, name, BCM2_TYPE_NIL);
+		}
+	}
+
+	if (!ret || (ret->type != type && type != BCM2_TYPE_NIL)) {
+		ret = get_version_opt(m_def, name, type);
 	}
 
-	if (ret && (ret->type == type || type == BCM2_TYPE_NIL)) {
-		return ret;
+	if (ret) {
+		val = *ret;
 	}
 
-	return get_version_opt(m_def, name, type);
+	return ret;
 }
 
 addrspace::addrspace(const bcm2_addrspace* a, const profile& p)
@@ -565,11 +581,11 @@ const profile::sp& profile::get(const string& name)
 
 const vector<profile::sp>& profile::list()
 {
-	if (s_profiles.empty()) {
+	call_once(profiles_once, [] {
 		for (const bcm2_profile* p = bcm2_profiles; p->name[0]; ++p) {
 			s_profiles.push_back(make_shared<profile_wrapper>(p));
 		}
-	}
+	});
 
 	return s_profiles;
 }
@@ -693,9 +709,22 @@ void profile::parse_opt_override(const string& str)
 		memcpy(val.val.s, valstr.data(), valstr.size());
 	}
 
+	lock_guard<mutex> lock(overrides_mutex);
 	profile::s_overrides[tok[0]] = val;
 }
 
+map<string, bcm2_typed_val> profile::get_opt_overrides()
+{
+	lock_guard<mutex> lock(overrides_mutex);
+	return s_overrides;
+}
+
+void profile::set_opt_overrides(const map<string, bcm2_typed_val>& overrides)
+{
+	lock_guard<mutex> lock(overrides_mutex);
+	s_overrides = overrides;
+}
+
 
 uint32_t magic_size(const bcm2_magic* magic)
 {
@@ -368,16 +368,27 @@ class version
 	}
 
 	bool has_opt(const std::string& name) const
-	{ return get_opt(name, BCM2_TYPE_NIL); }
+	{
+		bcm2_typed_val val;
+		return get_opt(name, BCM2_TYPE_NIL, val);
+	}
 
 	uint32_t get_opt_num(const std::string& name) const
-	{ return get_opt(name, BCM2_TYPE_U32)->val.n; }
+	{
+		bcm2_typed_val val;
+		get_opt(name, BCM2_TYPE_U32, val);
+		return val.val.n;
+	}
 
 	uint32_t get_opt_num(const std::string& name, uint32_t def) const
 	{ return has_opt(name) ? get_opt_num(name) : def; }
 
 	std::string get_opt_str(const std::string& name) const
-	{ return get_opt(name, BCM2_TYPE_STR)->val.s; }
+	{
+		bcm2_typed_val val;
+		get_opt(name, BCM2_TYPE_STR, val);
+		return val.val.s;
+	}
 
 	std::string get_opt_str(const std::string& name, const std::string& def) const
 	{ return has_opt(name) ? get_opt_str(name) : def; }
@@ -388,7 +399,9 @@ class version
 	private:
 	void parse_codecfg();
 	void parse_functions();
-	const bcm2_typed_val* get_opt(const std::string& name, bcm2_type type) const;
+	// copies the option to `val`. returns false if the option doesn't
+	// exist and type is BCM2_TYPE_NIL; otherwise, this throws.
+	bool get_opt(const std::string& name, bcm2_type type, bcm2_typed_val& val) const;
 
 	const bcm2_version* m_p;
 	const profile* m_prof;
@@ -458,6 +471,9 @@ class addrspace
 	unsigned alignment() const
 	{ return !m_p->alignment ? (is_mem() ? 4 : 1) : m_p->alignment; }
 
+	uint32_t blocksize() const
+	{ return m_p->blocksize; }
+
 	const std::vector<part>& partitions() const
 	{ return m_partitions; }
 
@@ -544,6 +560,9 @@ class profile
 	static const std::vector<profile::sp>& list();
 
 	static void parse_opt_override(const std::string& str);
+	static std::map<std::string, bcm2_typed_val> get_opt_overrides();
+	// must not be called while other threads may be using the options
+	static void set_opt_overrides(const std::map<std::string, bcm2_typed_val>& overrides);
 
 	friend class version;
 
@@ -44,6 +44,15 @@
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
+#define RWCODE_BASE64(v) \
+	((v) < 26 ? 'A' + (v) : ((v) < 52 ? 'a' + (v) - 26 : \
+	((v) < 62 ? '0' + (v) - 52 : ((v) == 62 ? '+' : '/'))))
+
+// byte i of a base64 line: n data bytes, followed by the crc16
+#define RWCODE_BASE64_BYTE(p, n, crc, i) \
+	((i) < (n) ? (p)[i] : ((i) == (n) ? ((crc) >> 8) & 0xff : \
+	((i) == (n) + 1 ? (crc) & 0xff : 0)))
+
 typedef uint32_t (*w3_fun)(uint32_t, uint32_t, uint32_t);
 typedef uint32_t (*w2_fun)(uint32_t, uint32_t);
 typedef int (*printf_fun)(const char*, ...);
@@ -104,12 +113,93 @@ void mips_read()
 
 	args->index += chunklen;
 
-	do {
-		for (int i = 0; i < 4; ++i) {
-			((printf_fun)args->printf)(args->str_x, *buffer++);
+	if (args->flags & BCM2_READ_FMT_CRC32) {
+		uint8_t* p = (uint8_t*)buffer;
+		uint32_t crc = 0xffffffff;
+		uint32_t k;
+
+		while (chunklen--) {
+			crc ^= *p++;
+			for (k = 0; k < 8; ++k) {
+				crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+			}
+		}
+
+		((printf_fun)args->printf)(args->str_crc, ~crc);
+		((printf_fun)args->printf)(args->str_nl);
+		return;
+	}
+
+	// OUTPUT format:
+	// :%x:%x:%x:%x (4 words), or
+	// @<base64 of up to 48 data bytes, followed by crc16-ccitt>, or
+	// *%x:%x (word count, word value) for runs of identical words
+
+	while (chunklen) {
+		uint32_t n;
+
+		if (args->flags & BCM2_READ_FMT_RLE) {
+			for (n = 1; n < (chunklen / 4) && buffer[n] == buffer[0]; ++n) {
+				;
+			}
+
+			// keep lines aligned to 16 bytes
+			n &= ~3;
+
+			if (n >= 8) {
+				((printf_fun)args->printf)(args->str_rle, n, *buffer);
+				((printf_fun)args->printf)(args->str_nl);
+				buffer += n;
+				chunklen -= n * 4;
+				continue;
+			}
+		}
+
+		if (!(args->flags & BCM2_READ_FMT_BASE64)) {
+			for (int i = 0; i < 4; ++i) {
+				((printf_fun)args->printf)(args->str_x, *buffer++);
+			}
+			((printf_fun)args->printf)(args->str_nl);
+			chunklen -= 16;
+			continue;
+		}
+
+		uint8_t* p = (uint8_t*)buffer;
+		char line[72];
+		char* l = line;
+		uint32_t crc = 0xffff;
+		uint32_t i, k;
+
+		n = MIN(chunklen, 48);
+
+		for (i = 0; i < n; ++i) {
+			crc ^= p[i] << 8;
+			for (k = 0; k < 8; ++k) {
+				crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+			}
 		}
+
+		*l++ = '@';
+
+		for (i = 0; i < n + 2; i += 3) {
+			uint32_t v = (RWCODE_BASE64_BYTE(p, n, crc, i) << 16)
+				| (RWCODE_BASE64_BYTE(p, n, crc, i + 1) << 8)
+				| RWCODE_BASE64_BYTE(p, n, crc, i + 2);
+
+			for (k = 0; k < 4; ++k) {
+				uint32_t c = (v >> (18 - 6 * k)) & 0x3f;
+				*l++ = (k <= (n + 2 - i)) ? RWCODE_BASE64(c) : '=';
+			}
+		}
+
+		*l = '\0';
+
+		// the base64 alphabet doesn't contain '%'
+		((printf_fun)args->printf)(line);
 		((printf_fun)args->printf)(args->str_nl);
-	} while ((chunklen -= 16));
+		buffer += n / 4;
+		chunklen -= n;
+	}
 }
 
 // INPUT format:
@@ -129,6 +219,7 @@ void mips_write()
 	uint32_t* buffer = (uint32_t*)(args->buffer + args->index);
 	uint32_t remaining = args->length - args->index;
 	uint32_t len = MIN(remaining, args->chunklen);
+	uint32_t lines = 0;
 	args->index += len;
 
 	do {
@@ -157,15 +248,19 @@ void mips_write()
 			goto err;
 		}
 
-		// FIXME this is ugly
-		if (ram) {
-			((printf_fun)args->printf)(args->str_2x + 3, buffer);
-		} else {
-			uint32_t off = args->offset + (((uint32_t)buffer) - args->buffer);
-			((printf_fun)args->printf)(args->str_2x + 3, off);
+		// always acknowledge the last line of a chunk
+		if (len == 8 || args->ack_interval <= 1 || !(++lines % args->ack_interval)) {
+			// FIXME this is ugly
+			if (ram) {
+				((printf_fun)args->printf)(args->str_2x + 3, buffer);
+			} else {
+				uint32_t off = args->offset + (((uint32_t)buffer) - args->buffer);
+				((printf_fun)args->printf)(args->str_2x + 3, off);
+			}
+
+			((printf_fun)args->printf)(args->str_nl);
 		}
 
-		((printf_fun)args->printf)(args->str_nl);
 		buffer += 2;
 	} while ((len -= 8));
 
@@ -38,6 +38,10 @@ struct bcm2_read_args
 	uint32_t printf;
 	uint32_t fl_read;
 	struct bcm2_patch patches[BCM2_PATCH_NUM];
+	// new fields must be added at the end, so that older
+	// versions of the dump code continue to work.
+	char str_rle[8];
+	char str_crc[8];
 } __attribute__((aligned(4)));
 
 void mips_read();
@@ -59,6 +63,8 @@ struct bcm2_write_args
 	uint32_t fl_write;
 	struct bcm2_patch erase_patches[BCM2_PATCH_NUM];
 	struct bcm2_patch write_patches[BCM2_PATCH_NUM];
+	// new fields must be appended, to remain compatible with older versions
+	uint32_t ack_interval;
 } __attribute__((aligned(4)));
 
 void mips_write();
@@ -20,9 +20,15 @@
 #include <unistd.h>
 #include <iostream>
 #include <cstddef>
+#include <condition_variable>
+#include <deque>
 #include <fstream>
+#include <thread>
+#include <atomic>
+#include <mutex>
 #include "progress.h"
 #include "rwcode2.h"
+#include "hexline.h"
 #include "util.h"
 #include "rwx.h"
 #include "ps.h"
@@ -67,11 +73,327 @@ class bad_chunk_line : public runtime_error
 
 const unsigned max_retry_count = 5;
 
+// picks the chunk length for rwx::dump(). after a retry, the chunk length
+// is halved. after a couple of chunks without retries, it is doubled again,
+// unless the throughput at that length was observed to be worse.
+class chunk_sizer
+{
+	public:
+	chunk_sizer(const rwx::limits& lim, bool adaptive)
+	: m_min(max(lim.min, lim.alignment)), m_max(lim.max), m_length(lim.max), m_adaptive(adaptive)
+	{
+		if (!m_min || m_min > m_max) {
+			m_adaptive = false;
+		}
+	}
+
+	uint32_t length() const
+	{ return m_length; }
+
+	void update(uint32_t length, unsigned retries, uint64_t ms)
+	{
+		auto& s = m_stats[length];
+		s.chunks += 1;
+		s.retries += retries;
+		s.bytes += length;
+		s.ms += ms;
+
+		if (!m_adaptive || length != m_length) {
+			return;
+		}
+
+		if (retries) {
+			m_length = max(m_min, align_left(m_length / 2, m_min));
+			m_good = 0;
+		} else if (++m_good >= 4 && m_length < m_max) {
+			uint32_t next = min(m_max, m_length * 2);
+			auto it = m_stats.find(next);
+			if (it == m_stats.end() || it->second.rate() >= s.rate()) {
+				m_length = next;
+			}
+			m_good = 0;
+		}
+	}
+
+	void print(ostream& os) const
+	{
+		if (m_stats.empty() || (m_stats.size() == 1 && !m_stats.begin()->second.retries)) {
+			return;
+		}
+
+		os << "chunk lengths:" << endl;
+
+		for (auto& s : m_stats) {
+			os << "  " << setw(6) << s.first << " b: " << s.second.chunks << " chunk(s), "
+					<< s.second.retries << " retries, " << uint64_t(s.second.rate() / 1024) << " KiB/s" << endl;
+		}
+	}
+
+	private:
+	struct stats
+	{
+		unsigned chunks = 0;
+		unsigned retries = 0;
+		uint64_t bytes = 0;
+		uint64_t ms = 0;
+
+		double rate() const
+		{ return 1000.0 * bytes / max(ms, uint64_t(1)); }
+	};
+
+	uint32_t m_min;
+	uint32_t m_max;
+	uint32_t m_length;
+	bool m_adaptive;
+	unsigned m_good = 0;
+	map<uint32_t, stats> m_stats;
+};
+
+// a bounded queue. push() blocks while the queue is full, and pop() blocks
+// while it is empty. once closed, push() fails, and pop() fails as soon as
+// the queue is empty.
+template<class T> class blocking_queue
+{
+	public:
+	explicit blocking_queue(size_t max) : m_max(max) {}
+
+	// `stalled` is set if the queue was full
+	bool push(T&& t, bool& stalled)
+	{
+		unique_lock<mutex> lock(m_mutex);
+		stalled = m_items.size() >= m_max;
+		m_not_full.wait(lock, [this] { return m_items.size() < m_max || m_closed; });
+
+		if (m_closed) {
+			return false;
+		}
+
+		m_items.push_back(move(t));
+		m_not_empty.notify_one();
+		return true;
+	}
+
+	bool pop(T& t)
+	{
+		unique_lock<mutex> lock(m_mutex);
+		m_not_empty.wait(lock, [this] { return !m_items.empty() || m_closed; });
+
+		if (m_items.empty()) {
+			return false;
+		}
+
+		t = move(m_items.front());
+		m_items.pop_front();
+		m_not_full.notify_one();
+		return true;
+	}
+
+	void close()
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_closed = true;
+		m_not_empty.notify_all();
+		m_not_full.notify_all();
+	}
+
+	size_t size() const
+	{
+		lock_guard<mutex> lock(m_mutex);
+		return m_items.size();
+	}
+
+	private:
+	const size_t m_max;
+	deque<T> m_items;
+	bool m_closed = false;
+	mutable mutex m_mutex;
+	condition_variable m_not_empty;
+	condition_variable m_not_full;
+};
+
+// writes rwx::dump()'s output on a separate thread, so that a slow output
+// stream doesn't keep us from draining the device's output. only the
+// output stream is used on that thread; progress and image listeners are
+// called by the reading thread, as usual.
+class dump_writer
+{
+	public:
+	typedef function<void(const string&)> consumer;
+
+	dump_writer(const consumer& consume, bool threaded)
+	: m_consume(consume), m_queue(32)
+	{
+		if (threaded) {
+			m_thread = thread(&dump_writer::run, this);
+		}
+	}
+
+	~dump_writer()
+	{
+		try {
+			finish();
+		} catch (...) {
+		}
+	}
+
+	void write(string&& chunk)
+	{
+		if (!m_thread.joinable()) {
+			m_consume(chunk);
+			return;
+		}
+
+		size_t depth = m_queue.size();
+		m_depth_sum += depth;
+		m_stats.max_depth = max(m_stats.max_depth, unsigned(depth + 1));
+		++m_stats.chunks;
+
+		bool stalled;
+		if (!m_queue.push(move(chunk), stalled)) {
+			// the writer thread has failed
+			finish();
+		}
+
+		m_stats.stalls += stalled;
+	}
+
+	// waits until all chunks have been written, and rethrows the writer
+	// thread's error, if any.
+	void finish()
+	{
+		if (m_thread.joinable()) {
+			m_queue.close();
+			m_thread.join();
+		}
+
+		if (m_stats.chunks) {
+			m_stats.avg_depth = double(m_depth_sum) / m_stats.chunks;
+		}
+
+		if (m_error) {
+			rethrow_exception(exchange(m_error, nullptr));
+		}
+	}
+
+	const rwx::pipeline_stats& stats() const
+	{ return m_stats; }
+
+	private:
+	void run()
+	{
+		try {
+			string chunk;
+			while (m_queue.pop(chunk)) {
+				m_consume(chunk);
+			}
+		} catch (...) {
+			m_error = current_exception();
+			m_queue.close();
+		}
+	}
+
+	consumer m_consume;
+	blocking_queue<string> m_queue;
+	thread m_thread;
+	exception_ptr m_error;
+	rwx::pipeline_stats m_stats;
+	uint64_t m_depth_sum = 0;
+};
+
 template<class T> T hex_cast(const std::string& str)
 {
 	return lexical_cast<T>(str, 16);
 }
 
+int from_base64(char c)
+{
+	if (c >= 'A' && c <= 'Z') {
+		return c - 'A';
+	} else if (c >= 'a' && c <= 'z') {
+		return c - 'a' + 26;
+	} else if (c >= '0' && c <= '9') {
+		return c - '0' + 52;
+	} else if (c == '+') {
+		return 62;
+	} else if (c == '/') {
+		return 63;
+	}
+
+	return -1;
+}
+
+// decodes a base64 line with a trailing crc16, appending the data to `buf`
+void parse_base64_line(string_view line, string& buf)
+{
+	if (line.empty() || (line.size() % 4)) {
+		throw bad_chunk_line::regular("invalid base64 line length");
+	}
+
+	size_t size = buf.size();
+
+	for (size_t i = 0; i < line.size(); i += 4) {
+		uint32_t v = 0;
+		unsigned bytes = 3;
+
+		for (size_t k = 0; k < 4; ++k) {
+			int c = from_base64(line[i + k]);
+			if (c < 0) {
+				if (line[i + k] != '=' || (i + 4) != line.size() || k < 2) {
+					throw bad_chunk_line::regular("invalid base64 character");
+				}
+
+				c = 0;
+				--bytes;
+			}
+
+			v = (v << 6) | c;
+		}
+
+		for (unsigned k = 0; k < bytes; ++k) {
+			buf += char(v >> (16 - 8 * k));
+		}
+	}
+
+	if ((buf.size() - size) <= 2) {
+		throw bad_chunk_line::regular("short base64 line");
+	}
+
+	uint16_t crc = ((buf[buf.size() - 2] & 0xff) << 8) | (buf[buf.size() - 1] & 0xff);
+	buf.resize(buf.size() - 2);
+
+	if (crc16_ccitt(buf.data() + size, buf.size() - size) != crc) {
+		throw bad_chunk_line::regular("crc mismatch");
+	}
+}
+
+// parses a `*<count>:<word>` line, appending `count` words to `buf`
+void parse_rle_line(string_view line, string& buf, uint32_t max)
+{
+	auto i = line.find(':');
+	if (i == string_view::npos) {
+		throw bad_chunk_line::regular("invalid rle line");
+	}
+
+	uint32_t count, word;
+
+	try {
+		count = hex_cast<uint32_t>(line.substr(0, i).to_string());
+		word = h_to_be(hex_cast<uint32_t>(line.substr(i + 1).to_string()));
+	} catch (const exception& e) {
+		throw bad_chunk_line::regular(e);
+	}
+
+	if (!count || count > (max / 4)) {
+		throw bad_chunk_line::regular("invalid rle count " + to_string(count));
+	}
+
+	buf.reserve(buf.size() + count * 4);
+
+	while (count--) {
+		append_buf(buf, word);
+	}
+}
+
 inline void patch32(string& buf, string::size_type offset, uint32_t n)
 {
 	patch<uint32_t>(buf, offset, h_to_be(n));
@@ -208,11 +530,24 @@ class parsing_rwx : public rwx
 	{ return cap_read; }
 
 	protected:
+	// subclasses that support pipelined reads must call this
+	virtual void init(uint32_t offset, uint32_t length, bool write) override
+	{
+		// give pipelining another chance with each dump
+		m_serial = false;
+	}
+
 	virtual string read_chunk(uint32_t offset, uint32_t length) override final
 	{
 		return read_chunk_impl(offset, length, 0);
 	}
 
+	virtual void hint_next_chunk(uint32_t offset, uint32_t length) override
+	{
+		m_next_offset = offset;
+		m_next_length = length;
+	}
+
 	virtual string read_special(uint32_t offset, uint32_t length) override;
 
 	virtual unsigned chunk_timeout(uint32_t offset, uint32_t length) const
@@ -221,15 +556,47 @@ class parsing_rwx : public rwx
 	virtual string read_chunk_impl(uint32_t offset, uint32_t length, uint32_t retries);
 	// issues a command that displays the requested chunk
 	virtual void do_read_chunk(uint32_t offset, uint32_t length) = 0;
+	// if true, the command for the next chunk may be issued before the
+	// current chunk has been fully read. in that case, do_read_chunk
+	// must use writeln_cmd.
+	virtual bool is_pipelineable() const
+	{ return false; }
 	// checks if the line is junk (as opposed to a possible chunk line)
-	virtual bool is_ignorable_line(const string& line) = 0;
-	// parses one line of data
-	virtual string parse_chunk_line(const string& line, uint32_t offset) = 0;
+	virtual bool is_ignorable_line(string_view line) = 0;
+	// parses one line of data, appending it to `chunk`
+	virtual void parse_chunk_line(string_view line, uint32_t offset, string& chunk) = 0;
 	// called if a chunk was not successfully read
 	virtual void on_chunk_retry(uint32_t offset, uint32_t length) {}
+	// if true, an incomplete chunk is resumed after the last line that was
+	// successfully parsed. this requires that parse_chunk_line rejects lines
+	// with an unexpected offset, so that the chunk never contains gaps.
+	virtual bool can_resume_chunk() const
+	{ return false; }
 
 	bcm2dump::sp<cmdline_interface> interface() const
 	{ return dynamic_pointer_cast<cmdline_interface>(m_intf); }
+
+	void writeln_cmd(const string& cmd)
+	{
+		if (m_nowait) {
+			interface()->writeln_nowait(cmd);
+		} else {
+			interface()->writeln(cmd);
+		}
+	}
+
+	private:
+	void queue_next_chunk();
+	void drain_queued_chunk();
+
+	uint32_t m_next_offset = 0;
+	uint32_t m_next_length = 0;
+	uint32_t m_queued_offset = 0;
+	uint32_t m_queued_length = 0;
+	bool m_queued = false;
+	bool m_nowait = false;
+	// set after the first retry, until the next init()
+	bool m_serial = false;
 };
 
 string parsing_rwx::read_special(uint32_t offset, uint32_t length)
@@ -246,38 +613,87 @@ string parsing_rwx::read_special(uint32_t offset, uint32_t length)
 	}
 }
 
+void parsing_rwx::queue_next_chunk()
+{
+	logger::t() << "read_chunk_impl: queueing 0x" << to_hex(m_next_offset) << "," << m_next_length << endl;
+
+	m_nowait = true;
+	do_read_chunk(m_next_offset, m_next_length);
+	m_nowait = false;
+	m_queued = true;
+	m_queued_offset = m_next_offset;
+	m_queued_length = m_next_length;
+}
+
+void parsing_rwx::drain_queued_chunk()
+{
+	logger::d() << "waiting for queued chunk 0x" << to_hex(m_queued_offset) << endl;
+
+	// one prompt for the current, and one for the queued command
+	interface()->wait_ready();
+	interface()->wait_ready();
+	interface()->wait_quiet(100);
+	m_queued = false;
+}
+
 string parsing_rwx::read_chunk_impl(uint32_t offset, uint32_t length, uint32_t retries)
 {
-	logger::t() << "read_chunk_impl: calling do_read_chunk" << endl;
+	if (m_queued && m_queued_offset == offset && m_queued_length == length) {
+		logger::t() << "read_chunk_impl: using queued command" << endl;
+		m_queued = false;
+	} else {
+		if (m_queued) {
+			drain_queued_chunk();
+		}
+
+		logger::t() << "read_chunk_impl: calling do_read_chunk" << endl;
+		do_read_chunk(offset, length);
+	}
 
-	do_read_chunk(offset, length);
+	bool pipeline = !m_serial && m_next_length && is_pipelineable();
 
 	uint32_t pos = offset;
 	string chunk;
+	chunk.reserve(length);
+
+	mstimer t;
+	uint64_t parse_us = 0;
 
 	logger::t() << "read_chunk_impl: consuming lines" << endl;
 
-	interface()->foreach_line_raw([this, &chunk, &pos, &length, &retries] (const string& line) {
+	interface()->foreach_line_view([this, &chunk, &pos, &length, &retries, &pipeline, &t, &parse_us] (string_view line) {
 		throw_if_interrupted();
-		string tline = trim(line);
+		string_view tline = trim_view(line);
 		if (!is_ignorable_line(tline)) {
+			size_t size = chunk.size();
+
 			try {
-				string linebuf = parse_chunk_line(tline, pos);
-				pos += linebuf.size();
-				chunk += linebuf;
+				auto start = t.elapsed_us();
+				parse_chunk_line(tline, pos, chunk);
+				parse_us += t.elapsed_us() - start;
+
+				if (!size && !chunk.empty()) {
+					m_chunk_stats.first_byte.add(start);
+				}
+
+				pos += chunk.size() - size;
 				update_progress(pos, chunk.size());
 
-				if (linebuf.empty()) {
+				if (chunk.size() == size) {
 					logger::t() << "no bytes found in '" << tline << "'" << endl;
+				} else if (pipeline && !m_queued) {
+					queue_next_chunk();
 				}
 			} catch (const bad_chunk_line& e) {
-				string msg = "bad chunk line @" + to_hex(pos) + ": '" + tline + "' (" + e.what() + ")";
+				chunk.resize(size);
+				string msg = "bad chunk line @" + to_hex(pos) + ": '" + tline.to_string() + "' (" + e.what() + ")";
 				if (e.critical() && retries >= max_retry_count) {
 					throw runtime_error(msg);
 				}
 
 				logger::t() << endl << msg << endl;
 			} catch (const exception& e) {
+				chunk.resize(size);
 				logger::d() << "error while parsing '" << tline << "': " << e.what() << endl;
 				return true;
 			}
@@ -288,17 +704,43 @@ string parsing_rwx::read_chunk_impl(uint32_t offset, uint32_t length, uint32_t r
 
 	logger::t() << "read_chunk_impl: done reading lines" << endl;
 
-	// consume any more output
-	interface()->wait_quiet(20);
+	m_chunk_stats.parse.add(parse_us);
+
+	if (!m_queued) {
+		// consume any more output
+		t.reset();
+		interface()->wait_quiet(20);
+		m_chunk_stats.wait_quiet.add(t.elapsed_us());
+	}
 
 	if (length && (chunk.size() != length)) {
 		string msg = "read incomplete chunk 0x" + to_hex(offset)
 					+ ": " + to_string(chunk.size()) + "/" +to_string(length);
+		if (m_queued) {
+			drain_queued_chunk();
+		}
+
+		if (pipeline) {
+			logger::d() << "disabling pipelined reads" << endl;
+			m_serial = true;
+		}
+
 		if (retries < max_retry_count) {
 			// if the dump is still underway, we need to wait for it to finish
 			// before issuing the next command. wait for up to 10 seconds.
 
 			if (interface()->wait_ready()) {
+				++m_retries;
+
+				uint32_t done = align_left(chunk.size(), limits_read().min);
+				if (done && can_resume_chunk()) {
+					logger::d() << endl << msg << "; resuming at 0x" << to_hex(offset + done) << endl;
+					chunk.resize(done);
+					on_chunk_retry(offset + done, length - done);
+					// we've made progress, so this doesn't count as a retry
+					return chunk + read_chunk_impl(offset + done, length - done, retries);
+				}
+
 				logger::d() << endl << msg << "; retrying" << endl;
 				on_chunk_retry(offset, length);
 				return read_chunk_impl(offset, length, retries + 1);
@@ -317,6 +759,9 @@ class bfc_ram : public parsing_rwx
 	public:
 	virtual ~bfc_ram() {}
 
+	virtual string name() const override
+	{ return "bfc_ram"; }
+
 	virtual limits limits_read() const override
 	{ return limits(4, 16, 2 * 8192); }
 
@@ -335,9 +780,19 @@ class bfc_ram : public parsing_rwx
 	protected:
 	virtual bool exec_impl(uint32_t offset) override;
 	virtual bool write_chunk(uint32_t offset, const string& chunk) override;
-	virtual bool is_ignorable_line(const string& line) override;
+	virtual bool is_ignorable_line(string_view line) override;
 	virtual void do_read_chunk(uint32_t offset, uint32_t length) override;
-	virtual string parse_chunk_line(const string& line, uint32_t offset) override;
+	virtual void parse_chunk_line(string_view line, uint32_t offset, string& chunk) override;
+	virtual bool is_pipelineable() const override;
+
+	virtual bool can_adapt_chunk_length() const override
+	{ return true; }
+
+	virtual bool can_resume_chunk() const override
+	{ return true; }
+
+	virtual bool can_dump_parallel() const override
+	{ return true; }
 };
 
 bool bfc_ram::exec_impl(uint32_t offset)
@@ -361,13 +816,18 @@ bool bfc_ram::write_chunk(uint32_t offset, const string& chunk)
 void bfc_ram::do_read_chunk(uint32_t offset, uint32_t length)
 {
 	if (interface()->is_privileged()) {
-		interface()->writeln("/read_memory -s 4 -n " + to_string(length) + " 0x" + to_hex(offset));
+		writeln_cmd("/read_memory -s 4 -n " + to_string(length) + " 0x" + to_hex(offset));
 	} else {
-		interface()->writeln("/system/diag readmem -s 4 -n " + to_string(length) + " 0x" + to_hex(offset));
+		writeln_cmd("/system/diag readmem -s 4 -n " + to_string(length) + " 0x" + to_hex(offset));
 	}
 }
 
-bool bfc_ram::is_ignorable_line(const string& line)
+bool bfc_ram::is_pipelineable() const
+{
+	return interface()->version().get_opt_num("bfc:pipelined_reads", false);
+}
+
+bool bfc_ram::is_ignorable_line(string_view line)
 {
 	if (line.size() >= 50) {
 		if (line.substr(8, 2) == ": " && line.substr(48, 2) == " |") {
@@ -382,40 +842,15 @@ bool bfc_ram::is_ignorable_line(const string& line)
 	return true;
 }
 
-string bfc_ram::parse_chunk_line(const string& line, uint32_t offset)
+void bfc_ram::parse_chunk_line(string_view line, uint32_t offset, string& chunk)
 {
-	const char* fmts[] = {
-		"%x: %x  %x  %x  %x",
-		"%u: %u  %u  %u  %u",
-	};
-
-	uint32_t data[4];
-	uint32_t off;
-	int n;
-
-	for (const char* fmt : fmts) {
-		n = sscanf(line.c_str(), fmt, &off, &data[0],
-				&data[1], &data[2], &data[3]);
-
-		if (n > 1 && off == offset) {
-			break;
-		}
-	}
+	uint32_t off = 0;
 
-	if (!n) {
+	if (!hexline::parse_bfc_ram_line(line, offset, off, chunk)) {
 		throw bad_chunk_line::regular();
 	} else if (off != offset) {
 		throw bad_chunk_line::critical("offset mismatch");
 	}
-
-	string linebuf;
-
-	for (int i = 0; i < (n - 1); ++i) {
-		linebuf += to_buf(be_to_h(data[i]));
-	}
-
-	return linebuf;
-
 }
 
 class bfc_flash2 : public bfc_ram
@@ -423,6 +858,9 @@ class bfc_flash2 : public bfc_ram
 	public:
 	virtual ~bfc_flash2() {}
 
+	virtual string name() const override
+	{ return "bfc_flash2"; }
+
 	virtual unsigned capabilities() const override
 	{ return cap_read; }
 
@@ -480,9 +918,9 @@ class bfc_flash2 : public bfc_ram
 		return 5 * 1000;
 	}
 
-	virtual string parse_chunk_line(const string& line, uint32_t offset) override
+	virtual void parse_chunk_line(string_view line, uint32_t offset, string& chunk) override
 	{
-		return bfc_ram::parse_chunk_line(line, m_cfg["buffer"] + (offset % limits_read().max));
+		bfc_ram::parse_chunk_line(line, m_cfg["buffer"] + (offset % limits_read().max), chunk);
 	}
 
 	virtual void do_read_chunk(uint32_t offset, uint32_t length) override
@@ -491,6 +929,19 @@ class bfc_flash2 : public bfc_ram
 		bfc_ram::do_read_chunk(m_cfg["buffer"], length);
 	}
 
+	virtual bool is_pipelineable() const override
+	{ return false; }
+
+	virtual bool can_adapt_chunk_length() const override
+	{ return false; }
+
+	virtual bool can_resume_chunk() const override
+	{ return false; }
+
+	// uses a shared buffer in ram
+	virtual bool can_dump_parallel() const override
+	{ return false; }
+
 	private:
 	void patch(const func& f)
 	{
@@ -572,6 +1023,9 @@ class bfc_flash : public parsing_rwx
 	virtual ~bfc_flash()
 	{ cleanup(); }
 
+	virtual string name() const override
+	{ return "bfc_flash"; }
+
 	virtual limits limits_read() const override;
 
 	virtual limits limits_write() const override
@@ -584,10 +1038,13 @@ class bfc_flash : public parsing_rwx
 	virtual bool write_chunk(uint32_t offset, const string& buf) override;
 
 	virtual void do_read_chunk(uint32_t offset, uint32_t length) override;
-	virtual bool is_ignorable_line(const string& line) override;
-	virtual string parse_chunk_line(const string& line, uint32_t offset) override;
+	virtual bool is_ignorable_line(string_view line) override;
+	virtual void parse_chunk_line(string_view line, uint32_t offset, string& chunk) override;
 	virtual void on_chunk_retry(uint32_t offset, uint32_t length) override;
 
+	virtual bool can_adapt_chunk_length() const override
+	{ return true; }
+
 	private:
 	uint32_t to_partition_offset(uint32_t offset) const;
 	bool use_direct_read() const;
@@ -653,13 +1110,13 @@ void bfc_flash::do_read_chunk(uint32_t offset, uint32_t length)
 {
 	offset = to_partition_offset(offset);
 	if (use_direct_read()) {
-		interface()->writeln("/flash/readDirect " + to_string(length) + " " + to_string(offset));
+		writeln_cmd("/flash/readDirect " + to_string(length) + " " + to_string(offset));
 	} else {
-		interface()->writeln("/flash/read 4 " + to_string(length) + " " + to_string(offset));
+		writeln_cmd("/flash/read 4 " + to_string(length) + " " + to_string(offset));
 	}
 }
 
-bool bfc_flash::is_ignorable_line(const string& line)
+bool bfc_flash::is_ignorable_line(string_view line)
 {
 	if (use_direct_read()) {
 		if (line.size() >= 53) {
@@ -676,35 +1133,11 @@ bool bfc_flash::is_ignorable_line(const string& line)
 	return true;
 }
 
-string bfc_flash::parse_chunk_line(const string& line, uint32_t offset)
+void bfc_flash::parse_chunk_line(string_view line, uint32_t offset, string& chunk)
 {
-	auto tok = split(line, ' ', false);
-	if (tok.empty()) {
-		throw bad_chunk_line::regular();
-	}
-
-	string linebuf;
-
-	for (auto num : tok) {
-		uint32_t n;
-		try {
-			n = hex_cast<uint32_t>(num);
-		} catch (const exception& e) {
-			throw bad_chunk_line::regular(e);
-		}
-
-		if (use_direct_read()) {
-			if (n > 0xff) {
-				throw bad_chunk_line::regular("invalid byte: 0x" + to_hex(n));
-			}
-
-			linebuf += char(n);
-		} else {
-			linebuf += to_buf(be_to_h(n));
-		}
+	if (!hexline::parse_bfc_flash_line(line, use_direct_read(), chunk)) {
+		throw bad_chunk_line::regular("invalid line: '" + line.to_string() + "'");
 	}
-
-	return linebuf;
 }
 
 uint32_t bfc_flash::to_partition_offset(uint32_t offset) const
@@ -747,6 +1180,9 @@ class bootloader_ram : public parsing_rwx
 	public:
 	virtual ~bootloader_ram() {}
 
+	virtual string name() const override
+	{ return "bootloader_ram"; }
+
 	virtual limits limits_read() const override
 	{ return limits(4, 4, 4); }
 
@@ -764,8 +1200,8 @@ class bootloader_ram : public parsing_rwx
 	virtual bool exec_impl(uint32_t offset) override;
 
 	virtual void do_read_chunk(uint32_t offset, uint32_t length) override;
-	virtual bool is_ignorable_line(const string& line) override;
-	virtual string parse_chunk_line(const string& line, uint32_t offset) override;
+	virtual bool is_ignorable_line(string_view line) override;
+	virtual void parse_chunk_line(string_view line, uint32_t offset, string& chunk) override;
 
 	private:
 	bool m_write = false;
@@ -814,7 +1250,7 @@ void bootloader_ram::do_read_chunk(uint32_t offset, uint32_t length)
 	interface()->writeln("0x" + to_hex(offset, 0));
 }
 
-bool bootloader_ram::is_ignorable_line(const string& line)
+bool bootloader_ram::is_ignorable_line(string_view line)
 {
 	if (contains(line, "Value at") || contains(line, "(hex)")) {
 		return false;
@@ -823,14 +1259,15 @@ bool bootloader_ram::is_ignorable_line(const string& line)
 	return true;
 }
 
-string bootloader_ram::parse_chunk_line(const string& line, uint32_t offset)
+void bootloader_ram::parse_chunk_line(string_view line, uint32_t offset, string& chunk)
 {
-	if (line.find("Value at") == 0) {
-		if (offset != hex_cast<uint32_t>(line.substr(9, 8))) {
+	if (starts_with(line, "Value at")) {
+		if (offset != hex_cast<uint32_t>(line.substr(9, 8).to_string())) {
 			throw bad_chunk_line::critical("offset mismatch");
 		}
 
-		return to_buf(h_to_be(hex_cast<uint32_t>(line.substr(19, 8))));
+		append_buf(chunk, h_to_be(hex_cast<uint32_t>(line.substr(19, 8).to_string())));
+		return;
 	}
 
 	throw bad_chunk_line::regular();
@@ -870,7 +1307,13 @@ bool bootloader_ram::exec_impl(uint32_t offset)
 class code_rwx : public parsing_rwx
 {
 	public:
-	code_rwx() {}
+	// `loader` is used to upload and execute the code, while the output is
+	// read from this object's interface. if not specified, the ram rwx of
+	// the same interface is used.
+	code_rwx(const rwx::sp& loader = nullptr) : m_ram(loader) {}
+
+	virtual string name() const override
+	{ return "code"; }
 
 	virtual limits limits_read() const override
 	{ return limits(16, 16, 0x4000); }
@@ -879,7 +1322,18 @@ class code_rwx : public parsing_rwx
 	{ return limits(8, 8, 0x4000); }
 
 	virtual unsigned capabilities() const override
-	{ return cap_rwx; }
+	{ return cap_rwx | (m_crc32 > 0 ? cap_crc32 : 0); }
+
+	virtual bool probe_crc32() override
+	{
+		if (m_crc32 < 0) {
+			// uploading the dump code tells us whether it supports crc32
+			auto cleaner = make_cleaner();
+			do_init(space().min(), limits_read().min, false);
+		}
+
+		return m_crc32 > 0;
+	}
 
 	virtual void set_interface(const interface::sp& intf) override
 	{
@@ -896,7 +1350,9 @@ class code_rwx : public parsing_rwx
 			throw runtime_error("rwcode address must be aligned to 4k");
 		}
 
-		m_ram = rwx::create(intf, "ram");
+		if (!m_ram) {
+			m_ram = rwx::create(intf, "ram");
+		}
 	}
 
 	protected:
@@ -905,7 +1361,7 @@ class code_rwx : public parsing_rwx
 		m_ram->exec(m_loadaddr + m_entry);
 	}
 
-	virtual bool is_ignorable_line(const string& line) override
+	virtual bool is_ignorable_line(string_view line) override
 	{
 		if (line.size() >= 8 && line.size() <= 36) {
 			if (line[0] == ':') {
@@ -913,52 +1369,109 @@ class code_rwx : public parsing_rwx
 			}
 		}
 
+		if (line.size() >= 25 && line.size() <= 69) {
+			if (line[0] == '@') {
+				return false;
+			}
+		}
+
+		if (line.size() >= 4 && line.size() <= 18) {
+			if (line[0] == '*') {
+				return false;
+			}
+		}
+
 		return true;
 	}
 
-	virtual string parse_chunk_line(const string& line, uint32_t offset) override
+	virtual void parse_chunk_line(string_view line, uint32_t offset, string& chunk) override
 	{
-		string linebuf;
+		if (line[0] == '@') {
+			parse_base64_line(line.substr(1), chunk);
+			return;
+		} else if (line[0] == '*') {
+			parse_rle_line(line.substr(1), chunk, limits_read().max);
+			return;
+		}
+
+		// even if we've requested base64 output, older
+		// versions of the dump code will ignore this flag.
+
+		line.remove_prefix(1);
 
-		auto values = split(line.substr(1), ':');
+		auto count = std::count(line.begin(), line.end(), ':') + 1;
 		auto lim = limits_read();
 
-		if (values.size() < (lim.min / 4) || values.size() > (lim.max / 4)) {
-			throw runtime_error("invalid chunk line: '" + line + "'");
+		if (count < (lim.min / 4) || count > (lim.max / 4)) {
+			throw runtime_error("invalid chunk line: ':" + line.to_string() + "'");
 		}
 
-		for (string val : values) {
-			linebuf += to_buf(h_to_be(hex_cast<uint32_t>(val)));
+		if (!hexline::parse_code_line(line, chunk)) {
+			throw runtime_error("invalid chunk line: ':" + line.to_string() + "'");
 		}
-
-		return linebuf;
 	}
 
+	// the lines printed by the dump code carry no offsets, so a missing
+	// line can't be told apart from a truncated chunk. resuming after the
+	// last parsed line could thus shift the rest of the chunk.
+	virtual bool can_resume_chunk() const override
+	{ return false; }
+
 	protected:
+	virtual bool can_skip_write_chunk() const override
+	{
+		// for non-ram address spaces, the data is flashed
+		// in one go, after the whole buffer has been filled.
+		// otherwise, rwx::write computes all crc32 values using the
+		// read code before the write code is uploaded.
+		return space().is_mem();
+	}
+
 	virtual bool write_chunk(uint32_t offset, const string& chunk) override
 	{
+		uint32_t index = offset - m_rw_offset;
+		if (index != m_write_index) {
+			// one or more chunks were skipped
+			m_ram->write(m_loadaddr + offsetof(bcm2_write_args, index), to_buf(h_to_be(index)));
+		}
+
 		m_ram->exec(m_loadaddr + m_entry);
 
-		for (size_t i = 0; i < chunk.size(); i += limits_write().min) {
-			string line;
+		// up to `window` lines are sent before waiting for an acknowledgement.
+		// each acknowledgement contains the offset of a line, and implicitly
+		// acknowledges all previous lines. older versions of the write code
+		// ignore the ack_interval setting, and acknowledge every line.
 
-			for (size_t k = 0; k < limits_write().min / 4; ++k) {
-				line += ":" + to_hex(chunk.substr(i + k * 4, 4));
-			}
+		const uint32_t step = limits_write().min;
+		const uint32_t window = get_write_window();
+		uint32_t sent = 0, acked = 0;
 
-			interface()->writeln(line);
+		while (acked < chunk.size()) {
+			for (; sent < chunk.size() && (sent - acked) < (window * step); sent += step) {
+				string line;
+
+				for (size_t k = 0; k < step / 4; ++k) {
+					line += ":" + to_hex(chunk.substr(sent + k * 4, 4));
+				}
+
+				interface()->writeln_nowait(line);
+			}
 
-			line = trim(interface()->readln());
-			if (line.empty() || line[0] != ':') {
-				throw runtime_error("expected offset, got '" + line + "'");
+			string line = trim(interface()->readln());
+			if (line.empty()) {
+				throw runtime_error("timeout waiting for offset 0x" + to_hex(offset + acked, 8));
+			} else if (line[0] != ':' || line.find(':', 1) != string::npos) {
+				// echo of a line we've sent, or other output
+				continue;
 			}
 
 			uint32_t actual = hex_cast<uint32_t>(line.substr(1));
-			if (actual != (offset + i)) {
-				throw runtime_error("expected offset 0x" + to_hex(offset + i, 8) + ", got 0x" + to_hex(actual));
+			if (actual < (offset + acked) || actual >= (offset + sent) || ((actual - offset) % step)) {
+				throw runtime_error("expected offset 0x" + to_hex(offset + acked, 8) + ", got 0x" + to_hex(actual));
 			}
 
-			update_progress(offset + i, 16);
+			acked = actual - offset + step;
+			update_progress(offset + acked, step);
 		}
 
 		if (!space().is_ram()) {
@@ -966,9 +1479,15 @@ class code_rwx : public parsing_rwx
 			interface()->wait_ready(60);
 		}
 
+		m_write_index = index + chunk.size();
 		return true;
 	}
 
+	uint32_t get_write_window() const
+	{
+		return max(interface()->version().get_opt_num("rwcode:write_window", 8), 1u);
+	}
+
 	bool is_prompt_line(const string& line, uint32_t offset)
 	{
 		if (line.empty() || line[0] != ':') {
@@ -988,14 +1507,87 @@ class code_rwx : public parsing_rwx
 		return true;
 	}
 
-	void on_chunk_retry(uint32_t offset, uint32_t length) override
+	virtual uint32_t crc32_block_max() const override
 	{
-		if (false) {
-			throw runtime_error("error recovery is not possible with custom dumpcode");
+		if (space().is_mem()) {
+			return 0;
 		}
 
-		if (!m_write) {
-			uint32_t index = offset - m_rw_offset;
+		// blocks are read into the buffer in one go
+		auto buflen = interface()->version().codecfg()["buflen"];
+		return buflen ? buflen : limits_read().max;
+	}
+
+	virtual vector<uint32_t> crc32_impl(uint32_t offset, uint32_t length, uint32_t block) override
+	{
+		m_crc_block = block;
+		auto cleaner = make_cleaner();
+		do_init(offset, length, false);
+		m_crc_block = 0;
+
+		vector<uint32_t> ret;
+
+		for (uint32_t i = 0; i < length; i += block) {
+			throw_if_interrupted();
+			m_ram->exec(m_loadaddr + m_entry);
+
+			uint32_t crc;
+			if (!read_crc32_line(crc)) {
+				throw runtime_error("failed to read crc32 of block 0x" + to_hex(offset + i));
+			}
+
+			ret.push_back(crc);
+			update_progress(offset + i + block, block);
+		}
+
+		return ret;
+	}
+
+	// reads the output of the dump code, when running in crc32 mode. if the
+	// dump code doesn't support crc32, *unsupported_p is set, or, if it's
+	// null, an exception is thrown.
+	bool read_crc32_line(uint32_t& crc, bool* unsupported_p = nullptr)
+	{
+		bool found = false, unsupported = false;
+
+		interface()->foreach_line_view([this, &crc, &found, &unsupported] (string_view line) {
+			line = trim_view(line);
+			if (line.size() >= 2 && line.size() <= 9 && line[0] == '#') {
+				crc = hex_cast<uint32_t>(line.substr(1).to_string());
+				found = true;
+				return true;
+			} else if (!is_ignorable_line(line)) {
+				// older versions of the dump code will ignore the flag
+				unsupported = true;
+				return true;
+			}
+
+			return false;
+		}, 10000);
+
+		if (unsupported) {
+			interface()->wait_ready();
+
+			if (!unsupported_p) {
+				throw runtime_error("dump code does not support crc32");
+			}
+		}
+
+		if (unsupported_p) {
+			*unsupported_p = unsupported;
+		}
+
+		return found;
+	}
+
+	void on_chunk_retry(uint32_t offset, uint32_t length) override
+	{
+		if (false) {
+			throw runtime_error("error recovery is not possible with custom dumpcode");
+		}
+
+		if (!m_write) {
+			uint32_t index = offset - m_rw_offset;
 			m_ram->write(m_loadaddr + offsetof(bcm2_read_args, index), to_buf(h_to_be(index)));
 		} else {
 			// TODO: implement if we ever use on_chunk_retry for writes
@@ -1013,10 +1605,9 @@ class code_rwx : public parsing_rwx
 
 	void init(uint32_t offset, uint32_t length, bool write) override
 	{
-		const profile::sp& profile = interface()->profile();
 		auto cfg = interface()->version().codecfg();
 
-		if (cfg["buflen"] && length > cfg["buflen"]) {
+		if (cfg["buflen"] && (m_crc_block ? m_crc_block : length) > cfg["buflen"]) {
 			throw user_error("requested length exceeds buffer size ("
 					+ to_string(cfg["buflen"]) + " b)");
 		}
@@ -1030,9 +1621,9 @@ class code_rwx : public parsing_rwx
 		m_write = write;
 		m_rw_offset = offset;
 		m_rw_length = length;
+		m_write_index = 0;
 
-		uint32_t kseg1 = profile->kseg1();
-		m_loadaddr = kseg1 | (cfg["rwcode"] + (write ? 0 : 0 /*0x10000*/));
+		m_loadaddr = get_loadaddr(write);
 
 		string code;
 
@@ -1059,42 +1650,180 @@ class code_rwx : public parsing_rwx
 			size_t codesize = code.size() - m_entry;
 
 			uint32_t expected = 0xc0de0000 | crc16_ccitt(code.substr(m_entry, codesize));
-			uint32_t actual = be_to_h(extract<uint32_t>(m_ram->read(m_loadaddr + codesize, 4)));
-			bool quick = (expected == actual);
+			// the marker is stored right after the code
+			uint32_t actual = be_to_h(extract<uint32_t>(m_ram->read(m_loadaddr + m_entry + codesize, 4)));
+
+			bool present = (expected == actual);
+
+			if (present) {
+				// if the code is already there, only the arguments need to be
+				// updated. with the bootloader's 4-byte reads, this saves
+				// several hundred menu commands.
+				upload_args(code.substr(0, m_entry), m_ram->read(m_loadaddr, m_entry));
+
+				if (!write && m_crc32 < 0) {
+					uint32_t crc;
+					if (crc32_code(code, crc) && crc != bcm2dump::crc32(code.substr(m_entry, crc32_code_length(code)))) {
+						logger::d() << "dump code at 0x" << to_hex(m_loadaddr) << " was modified" << endl;
+						present = false;
+					}
+				}
+			}
+
+			if (!present) {
+				upload_code(code, to_buf(h_to_be(expected)));
+			}
+		}
+	}
 
-			code += to_buf(h_to_be(expected));
+	uint32_t get_loadaddr(bool write) const
+	{
+		auto cfg = interface()->version().codecfg();
+		return interface()->profile()->kseg1() | (cfg["rwcode"] + (write ? 0 : 0 /*0x10000*/));
+	}
 
-#if 1
-			ofstream("code.bin").write(code.data(), code.size());
-#endif
+	// writes the words of `data` that differ from `current` (or all of them,
+	// if `current` is empty). adjacent words are written using a single
+	// write() call. returns the number of bytes written.
+	uint32_t upload(uint32_t offset, const string& data, const string& current, progress* pg = nullptr)
+	{
+		uint32_t written = 0;
 
-			progress pg;
-			progress_init(&pg, m_loadaddr, code.size());
+		for (uint32_t i = 0; i < data.size(); i += 4) {
+			uint32_t end = i;
 
-			if (m_prog_l && !quick) {
-				logger::i("updating code at 0x%08x (%u b)\n", m_loadaddr, static_cast<unsigned>(code.size()));
+			while (end < data.size() && (current.empty() || current.compare(end, 4, data, end, 4))) {
+				end += 4;
 			}
 
-			for (unsigned pass = 0; pass < 2; ++pass) {
-				string ramcode = m_ram->read(m_loadaddr, code.size());
-				for (uint32_t i = 0; i < code.size(); i += 4) {
-					if (!quick && pass == 0 && m_prog_l) {
-						progress_add(&pg, 4);
-						logger::i("\r ");
-						progress_print(&pg, stdout);
-					}
+			if (end != i) {
+				m_ram->write(offset + i, data.substr(i, end - i));
+				written += end - i;
+				i = end;
 
-					if (ramcode.substr(i, 4) != code.substr(i, 4)) {
-						if (pass == 1) {
-							throw runtime_error("dump code verification failed at 0x" + to_hex(i + m_loadaddr, 8));
-						}
-						m_ram->write(m_loadaddr + i, code.substr(i, 4));
-					}
+				if (pg && m_prog_l) {
+					progress_set(pg, offset + i);
+					logger::i("\r ");
+					progress_print(pg, stdout);
 				}
 			}
+		}
+
+		return written;
+	}
+
+	void upload_args(const string& args, const string& current)
+	{
+		if (upload(m_loadaddr, args, current) && m_ram->read(m_loadaddr, args.size()) != args) {
+			throw runtime_error("dump code verification failed at 0x" + to_hex(m_loadaddr, 8));
+		}
+	}
+
+	void upload_code(const string& code, const string& marker)
+	{
+		string current;
+
+		// like rwx::write, only read back the current contents if reading
+		// is much faster than writing.
+		if (m_ram->limits_read().max >= (16 * m_ram->limits_write().max)) {
+			current = m_ram->read(m_loadaddr, code.size());
+		}
+
+		if (m_prog_l) {
+			logger::i("updating code at 0x%08x (%u b)\n", m_loadaddr, static_cast<unsigned>(code.size()));
+		}
+
+		progress pg;
+		progress_init(&pg, m_loadaddr, code.size());
+		upload(m_loadaddr, code, current, &pg);
+		logger::i("\n");
+
+		verify_code(code);
+
+		// the marker is written last, so that a partial upload is never
+		// mistaken for a complete one.
+		m_ram->write(m_loadaddr + code.size(), marker);
+	}
+
+	void verify_code(const string& code)
+	{
+		if (m_write) {
+			// the write code can't calculate checksums
+			verify_code_readback(code, 0);
+			return;
+		}
+
+		uint32_t crc;
+		uint32_t length = crc32_code_length(code);
+
+		if (!crc32_code(code, crc)) {
+			// crc32_code has modified the arguments, so skip them
+			logger::d() << "dump code does not support crc32; reading it back" << endl;
+			verify_code_readback(code, m_entry);
+		} else if (crc != bcm2dump::crc32(code.substr(m_entry, length))) {
+			throw runtime_error("dump code verification failed (crc32 0x" + to_hex(crc) + ")");
+		} else if (m_entry + length < code.size()) {
+			verify_code_readback(code, m_entry + length);
+		}
+	}
+
+	// compares the code in memory with `code`, starting at `offset`
+	void verify_code_readback(const string& code, uint32_t offset)
+	{
+		string current = m_ram->read(m_loadaddr + offset, code.size() - offset);
+		for (uint32_t i = 0; i < current.size(); i += 4) {
+			if (current.compare(i, 4, code, offset + i, 4)) {
+				throw runtime_error("dump code verification failed at 0x" + to_hex(m_loadaddr + offset + i, 8));
+			}
+		}
+	}
+
+	// runs the dump code in crc32 mode, on itself. this requires only one
+	// exec, instead of reading back the whole code. returns false if the
+	// dump code doesn't support crc32. only the first crc32_code_length()
+	// bytes of the code are checked.
+	bool crc32_code(const string& code, uint32_t& crc)
+	{
+		auto cfg = interface()->version().codecfg();
+		uint32_t codesize = crc32_code_length(code);
+
+		bcm2_read_args args = { ":%x", "\r\n" };
+		strncpy(args.str_rle, "*%x:%x", sizeof(args.str_rle));
+		strncpy(args.str_crc, "#%x", sizeof(args.str_crc));
+		args.flags = h_to_be(BCM2_READ_FMT_CRC32);
+		args.buffer = h_to_be(m_loadaddr + m_entry);
+		args.offset = 0;
+		args.length = h_to_be(codesize);
+		args.chunklen = h_to_be(codesize);
+		args.index = 0;
+		args.printf = h_to_be(interface()->profile()->kseg1() | cfg["printf"]);
+		args.fl_read = 0;
+		memset(args.patches, 0, sizeof(args.patches));
+
+		upload_args(to_buf(args), code.substr(0, m_entry));
+		m_ram->exec(m_loadaddr + m_entry);
 
-			logger::i("\n");
+		bool unsupported;
+		bool found = read_crc32_line(crc, &unsupported);
+		m_crc32 = !unsupported;
+
+		// either way, the dump code has advanced the index
+		string current = to_buf(args);
+		patch32(current, offsetof(bcm2_read_args, index), codesize);
+		upload_args(code.substr(0, m_entry), current);
+
+		if (m_crc32 && !found) {
+			throw runtime_error("failed to read crc32 of dump code");
 		}
+
+		return m_crc32;
+	}
+
+	// the dump code prints 16 bytes per line, so older versions, which ignore
+	// the crc32 flag, would never finish a length that isn't a multiple of 16.
+	uint32_t crc32_code_length(const string& code) const
+	{
+		return align_left(code.size() - m_entry, 16);
 	}
 
 	template<size_t N> void copy_patches(bcm2_patch (&dest)[N], const func& f, uint32_t kseg1)
@@ -1127,6 +1856,9 @@ class code_rwx : public parsing_rwx
 		args.chunklen = h_to_be(limits_read().max);
 		args.index = 0;
 		args.fl_write = 0;
+		// must not exceed the window size, or we'll wait forever
+		args.ack_interval = h_to_be(min(get_write_window(),
+				max(interface()->version().get_opt_num("rwcode:write_ack_interval", 4), 1u)));
 
 		if (space().is_ram()) {
 			args.buffer = h_to_be(offset);
@@ -1175,20 +1907,37 @@ class code_rwx : public parsing_rwx
 			throw user_error("profile " + profile->name() + " does not support fast dump mode; use -s flag");
 		}
 
+		uint32_t flags = 0;
+
+		if (interface()->version().get_opt_num("rwcode:read_base64", true)) {
+			flags |= BCM2_READ_FMT_BASE64;
+		}
+
+		if (interface()->version().get_opt_num("rwcode:read_rle", true)) {
+			flags |= BCM2_READ_FMT_RLE;
+		}
+
+		if (m_crc_block) {
+			flags = BCM2_READ_FMT_CRC32;
+		}
+
 		bcm2_read_args args = { ":%x", "\r\n" };
+		strncpy(args.str_rle, "*%x:%x", sizeof(args.str_rle));
+		strncpy(args.str_crc, "#%x", sizeof(args.str_crc));
 		args.length = h_to_be(length);
 		args.index = 0;
-		args.chunklen = h_to_be(limits_read().max);
+		args.chunklen = h_to_be(m_crc_block ? m_crc_block : limits_read().max);
 		args.printf = h_to_be(kseg1 | cfg["printf"]);
 
 		if (m_space.is_mem()) {
 			args.buffer = h_to_be(offset);
 			args.offset = 0;
+			args.flags = h_to_be(flags);
 			args.fl_read = 0;
 		} else {
 			args.offset = h_to_be(offset);
 			args.buffer = h_to_be(kseg1 | cfg["buffer"]);
-			args.flags = h_to_be(fl_read.args());
+			args.flags = h_to_be(fl_read.args() | flags);
 			args.fl_read = h_to_be(kseg1 | fl_read.addr());
 		}
 
@@ -1199,10 +1948,15 @@ class code_rwx : public parsing_rwx
 
 	uint32_t m_loadaddr = 0;
 	uint32_t m_entry = 0;
+	// if non-zero, the dump code is initialized to print crc32 values
+	uint32_t m_crc_block = 0;
+	// whether the dump code supports crc32 (-1 = unknown)
+	int m_crc32 = -1;
 
 	bool m_write = false;
 	uint32_t m_rw_offset = 0;
 	uint32_t m_rw_length = 0;
+	uint32_t m_write_index = 0;
 
 	rwx::sp m_ram;
 };
@@ -1229,11 +1983,42 @@ rwx::sp create_code_rwx(const interface::sp& intf, const addrspace& space)
 	}
 }
 
+#ifdef BCM2DUMP_WITH_SNMP
+// uses the snmp interface only to upload and execute the dump code,
+// while its output is read from the console, specified by snmp:console.
+rwx::sp create_snmp_code_rwx(const sp<snmp>& intf, const addrspace& space)
+{
+	try {
+		auto loader = intf->create_rwx(space, true);
+		loader->set_interface(intf);
+		loader->set_addrspace(space);
+
+		auto console = interface::create(intf->version().get_opt_str("snmp:console"),
+				intf->profile()->name());
+		if (console->name() != "bfc") {
+			throw runtime_error("snmp:console is not a bfc console");
+		}
+
+		rwx::sp ret = make_shared<code_rwx>(loader);
+		ret->set_interface(console);
+		ret->set_addrspace(console->profile()->space(space.name(), console->id()));
+		return ret;
+	} catch (const exception& e) {
+		logger::d() << e.what() << endl;
+		logger::i() << "falling back to safe method" << endl;
+		return nullptr;
+	}
+}
+#endif
+
 class bfc_cmcfg : public parsing_rwx
 {
 	public:
 	virtual ~bfc_cmcfg() {}
 
+	virtual string name() const override
+	{ return "bfc_cmcfg"; }
+
 	virtual limits limits_read() const override
 	{ return limits(1); }
 
@@ -1245,8 +2030,8 @@ class bfc_cmcfg : public parsing_rwx
 
 	protected:
 	virtual void do_read_chunk(uint32_t offset, uint32_t length) override;
-	virtual bool is_ignorable_line(const string& line) override;
-	virtual string parse_chunk_line(const string& line, uint32_t offset) override;
+	virtual bool is_ignorable_line(string_view line) override;
+	virtual void parse_chunk_line(string_view line, uint32_t offset, string& chunk) override;
 
 	virtual string read_special(uint32_t offset, uint32_t length) override
 	{ return parsing_rwx::read_special(offset, length) + "\xff"; }
@@ -1257,16 +2042,15 @@ void bfc_cmcfg::do_read_chunk(uint32_t offset, uint32_t length)
 	interface()->writeln("/docsis_ctl/cfg_hex_show");
 }
 
-bool bfc_cmcfg::is_ignorable_line(const string& line)
+bool bfc_cmcfg::is_ignorable_line(string_view line)
 {
 	//bool ret = line.size() != 75 || line.substr(55, 4) != "  | ";
 	bool ret = line.size() < 58 || line.size() > 73 || line.substr(53, 4) != "  | ";
 	return ret;
 }
 
-string bfc_cmcfg::parse_chunk_line(const string& line, uint32_t)
+void bfc_cmcfg::parse_chunk_line(string_view line, uint32_t, string& chunk)
 {
-	string linebuf;
 	for (unsigned i = 0; i < 16; ++i) {
 		unsigned offset = 2 * (i / 4) + 3 * i;
 		if (offset > line.size() || offset + 2 > line.size()) {
@@ -1274,20 +2058,21 @@ string bfc_cmcfg::parse_chunk_line(const string& line, uint32_t)
 		}
 
 		try {
-			linebuf += hex_cast<int>(line.substr(offset, 2));
+			chunk += hex_cast<int>(line.substr(offset, 2).to_string());
 		} catch (const bad_lexical_cast& e) {
 			if (line.size() == 73) {
 				throw e;
 			}
 		}
 	}
-
-	return linebuf;
 }
 
 class bfc_bootassist : public rwx
 {
 	public:
+	virtual string name() const override
+	{ return "bfc_bootassist"; }
+
 	virtual limits limits_read() const override
 	{ return { 4, 4, 0x10000 }; }
 
@@ -1302,6 +2087,14 @@ class bfc_bootassist : public rwx
 		rwx::set_interface(intf);
 		m_ram = rwx::create(intf, "ram");
 
+		// registers are always accessed using m_ram, while image blocks
+		// are transferred using the fastest reader available.
+		if (intf->name() == "bfc") {
+			m_reader = create_code_rwx(intf, m_ram->space());
+		} else {
+			m_reader = rwx::create(intf, "ram", false);
+		}
+
 		auto v = intf->version();
 		m_cpuc_reg_request = v.get_opt_num("bootassist:cpuc_reg_request", 0xd3800044);
 		m_mbox_reg_cmstate = v.get_opt_num("bootassist:mbox_reg_cmstate", 0xd3800084);
@@ -1309,6 +2102,7 @@ class bfc_bootassist : public rwx
 		m_mbox_reg_imgbuf = v.get_opt_num("bootassist:mbox_reg_imgbuf", 0xd3800094);
 		m_cmstate_value = v.get_opt_num("bootassist:cmstate_value", 7);
 		m_request_value = v.get_opt_num("bootassist:request_value", 0x20);
+		m_prefetch = v.get_opt_num("bootassist:prefetch", true);
 	}
 
 	static bool is_supported(const interface::sp& intf, const addrspace& space)
@@ -1339,16 +2133,77 @@ class bfc_bootassist : public rwx
 
 	virtual void cleanup() override
 	{
+		if (m_pending_block) {
+			// leave the mailbox idle
+			try {
+				wait_block(m_pending_block);
+			} catch (const exception& e) {
+				logger::d() << e.what() << endl;
+			}
+
+			m_pending_block = 0;
+		}
+
+		m_next_block = 0;
 		m_ram->write32(m_mbox_reg_cmstate, m_cmstate_saved);
 	}
 
+	virtual void hint_next_chunk(uint32_t offset, uint32_t length) override
+	{
+		m_next_block = length ? (offset / limits_read().max) + 1 : 0;
+	}
+
 	virtual std::string read_chunk(uint32_t offset, uint32_t length) override
 	{
 		unsigned block = (offset / limits_read().max) + 1;
+		uint32_t buffer;
+
+		if (m_pending_block == block) {
+			buffer = m_pending_buffer;
+			m_pending_block = 0;
+		} else {
+			request_block(block);
+			buffer = wait_block(block);
+		}
+
+		// while block n is being transferred, the device prepares block n+1.
+		// this only works if it doesn't use the same buffer for both.
+
+		bool prefetch = m_prefetch && m_next_block && m_next_block != block;
+		if (prefetch) {
+			request_block(m_next_block);
+		}
+
+		string chunk = transfer(buffer, offset, length);
+
+		if (prefetch) {
+			m_pending_buffer = wait_block(m_next_block);
+
+			if (m_pending_buffer == buffer) {
+				logger::d() << "bootassist: buffer 0x" << to_hex(buffer) << " was reused; disabling prefetch" << endl;
+				m_prefetch = false;
+				++m_retries;
+				return read_chunk(offset, length);
+			}
+
+			m_pending_block = m_next_block;
+		}
+
+		return chunk;
+	}
 
+	virtual std::string read_special(uint32_t, uint32_t) override
+	{ throw runtime_error(__func__); }
+
+	private:
+	void request_block(unsigned block)
+	{
 		m_ram->write32(m_cpuc_reg_request, m_request_value);
 		m_ram->write32(m_mbox_reg_imgreq, block | (((m_image & 0xffff) - 1) << 31));
+	}
 
+	uint32_t wait_block(unsigned block)
+	{
 		mstimer t;
 
 		do {
@@ -1358,33 +2213,47 @@ class bfc_bootassist : public rwx
 					throw runtime_error("error retrieving block " + to_string(block));
 				}
 
-#if 1
-				string chunk;
-
-				const unsigned n = 32;
-				auto remaining = length;
-
-				for (uint32_t i = 0; i < length; i += n) {
-					auto size = min(n, remaining);
-					chunk += m_ram->read(0xa0000000 | (buffer + i), size);
-					remaining -= n;
-					update_progress(offset + i, size);
-				}
-#else
-				string chunk = m_ram->read(0xa0000000 | buffer, length);
-#endif
-				return chunk;
+				return buffer;
 			}
 		} while (t.elapsed() < 5000);
 
 		throw runtime_error("timeout retrieving block " + to_string(block));
 	}
 
-	virtual std::string read_special(uint32_t, uint32_t) override
-	{ throw runtime_error(__func__); }
+	string transfer(uint32_t buffer, uint32_t offset, uint32_t length)
+	{
+		// the reader's progress is relative to the buffer
+		auto forward = [this, buffer, offset] (uint32_t off, uint32_t len, bool write, bool init) {
+			if (!init && off != UINT32_MAX) {
+				update_progress(offset + (off - (0xa0000000 | buffer)), len);
+			}
+		};
+
+		if (m_reader != m_ram) {
+			try {
+				m_reader->set_progress_listener(forward);
+				bcm2dump::cleaner c { [this] { m_reader->set_progress_listener(); }};
+				return m_reader->read(0xa0000000 | buffer, length);
+			} catch (const interrupted&) {
+				throw;
+			} catch (const exception& e) {
+				logger::d() << e.what() << endl;
+				logger::i() << "falling back to safe method" << endl;
+				m_reader = m_ram;
+			}
+		}
+
+		m_ram->set_progress_listener(forward);
+		bcm2dump::cleaner c { [this] { m_ram->set_progress_listener(); }};
+		return m_ram->read(0xa0000000 | buffer, length);
+	}
 
-	private:
 	sp m_ram;
+	sp m_reader;
+	bool m_prefetch = true;
+	unsigned m_next_block = 0;
+	unsigned m_pending_block = 0;
+	uint32_t m_pending_buffer = 0;
 	unsigned m_image;
 	uint32_t m_cmstate_saved;
 	uint32_t m_cpuc_reg_request;
@@ -1399,21 +2268,46 @@ class bfc_bootassist : public rwx
 unsigned rwx::s_count = 0;
 sigh_type rwx::s_sighandler_orig = nullptr;
 volatile sig_atomic_t rwx::s_sigint = 0;
+thread_local unsigned rwx::s_no_interrupt = 0;
+
+namespace {
+mutex sighandler_mutex;
+}
 
 rwx::rwx()
 {
+	lock_guard<mutex> lock(sighandler_mutex);
+
 	if (++s_count == 1) {
+		s_sigint = 0;
 		s_sighandler_orig = signal(SIGINT, &rwx::handle_sigint);
 	}
 }
 
 rwx::~rwx()
 {
+	lock_guard<mutex> lock(sighandler_mutex);
+
 	if (--s_count == 0) {
 		signal(SIGINT, s_sighandler_orig);
 	}
 }
 
+bool rwx::skip_completed(ostream& os, uint32_t& offset, uint32_t& length)
+{
+	uint32_t completed = get_stream_size(os);
+	if (completed >= length) {
+		logger::i() << "nothing to resume" << endl;
+		return false;
+	}
+
+	offset += completed;
+	length -= completed;
+	logger::v() << "resuming at offset 0x" + to_hex(offset) << endl;
+	os.seekp(completed, ios::cur);
+	return true;
+}
+
 void rwx::require_capability(unsigned cap)
 {
 	if ((capabilities() & cap) == cap) {
@@ -1467,17 +2361,8 @@ void rwx::dump(uint32_t offset, uint32_t length, std::ostream& os, bool resume)
 		m_space.check_range(offset, length);
 	}
 
-	if (resume) {
-		uint32_t completed = get_stream_size(os);
-		if (completed >= length) {
-			logger::i() << "nothing to resume" << endl;
-			return;
-		} else {
-			offset += completed;
-			length -= completed;
-			logger::v() << "resuming at offset 0x" + to_hex(offset) << endl;
-			os.seekp(completed, ios::cur);
-		}
+	if (resume && !skip_completed(os, offset, length)) {
+		return;
 	}
 
 	uint32_t offset_r = align_left(offset, limits_read().alignment);
@@ -1495,11 +2380,30 @@ void rwx::dump(uint32_t offset, uint32_t length, std::ostream& os, bool resume)
 	bool show_hdr = true;
 	string hdrbuf;
 
+	// a writer thread isn't worth it for small dumps
+	bool threaded = m_intf->version().get_opt_num("rwx:threaded_dump", true)
+			&& length_r >= m_intf->version().get_opt_num("rwx:threaded_dump_min", 0x10000);
+
+	dump_writer writer([&os] (const string& chunk_w) {
+		os.write(chunk_w.data(), chunk_w.size());
+	}, threaded);
+
+	chunk_sizer sizer(limits_read(), can_adapt_chunk_length());
+
 	while (length_r) {
 		throw_if_interrupted();
 
-		uint32_t n = min(length_r, limits_read().max);
+		uint32_t n = min(length_r, sizer.length());
+		hint_next_chunk(offset_r + n, min(length_r - n, sizer.length()));
+
+		mstimer t;
+		unsigned retries = m_retries;
 		string chunk = read_chunk(offset_r, n);
+		sizer.update(n, m_retries - retries, t.elapsed());
+
+		m_chunk_stats.latency.add(t.elapsed_us());
+		m_chunk_stats.bytes.add(chunk.size());
+		m_chunk_stats.retries.add(m_retries - retries);
 
 		if (offset_r > (offset + length)) {
 			update_progress(offset + length - 2, 0);
@@ -1524,7 +2428,9 @@ void rwx::dump(uint32_t offset, uint32_t length, std::ostream& os, bool resume)
 			chunk_w = chunk.substr(0, min(n, length_w));
 		}
 
-		os.write(chunk_w.data(), chunk_w.size());
+		length_w -= chunk_w.size();
+		length_r -= n;
+		offset_r += n;
 
 		if (show_hdr) {
 			if (hdrbuf.size() < sizeof(ps_header)) {
@@ -1542,9 +2448,18 @@ void rwx::dump(uint32_t offset, uint32_t length, std::ostream& os, bool resume)
 			}
 		}
 
-		length_w -= chunk_w.size();
-		length_r -= n;
-		offset_r += n;
+		writer.write(move(chunk_w));
+	}
+
+	writer.finish();
+	m_pipeline_stats = writer.stats();
+
+	sizer.print(logger::v());
+
+	if (threaded) {
+		logger::d() << "writer queue: " << m_pipeline_stats.chunks << " chunk(s), depth "
+				<< m_pipeline_stats.avg_depth << " avg, " << m_pipeline_stats.max_depth << " max, "
+				<< m_pipeline_stats.stalls << " stall(s)" << endl;
 	}
 }
 
@@ -1556,6 +2471,159 @@ void rwx::dump(const string& spec, ostream& os, bool resume)
 	return dump(offset, length, os, resume);
 }
 
+void rwx::dump_parallel(const string& spec, ostream& os, const vector<sp>& others, bool resume)
+{
+	require_capability(cap_read);
+	uint32_t offset, length;
+	parse_offset_size(*this, spec, offset, length, false);
+
+	for (auto& rwx : others) {
+		rwx->set_partition(m_partition);
+	}
+
+	dump_parallel(offset, length, os, others, resume);
+}
+
+void rwx::dump_parallel(uint32_t offset, uint32_t length, ostream& os, const vector<sp>& others, bool resume)
+{
+	if (others.empty() || !can_dump_parallel()) {
+		return dump(offset, length, os, resume);
+	}
+
+	require_capability(cap_read);
+	m_space.check_range(offset, length);
+
+	if (resume && !skip_completed(os, offset, length)) {
+		return;
+	}
+
+	vector<rwx*> workers { this };
+	for (auto& rwx : others) {
+		workers.push_back(rwx.get());
+	}
+
+	// a stripe is read using a separate call to dump(), so it should be
+	// large enough to make up for the cost of init() and cleanup().
+	uint32_t stripe = max(length / (4 * uint32_t(workers.size())), limits_read().max);
+	stripe = align_right(stripe, max(limits_read().min, limits_read().alignment));
+	uint32_t count = (length + stripe - 1) / stripe;
+	// limits the number of stripes that are buffered in memory
+	uint32_t window = 2 * uint32_t(workers.size());
+
+	logger::d() << "reading " << count << " stripe(s) of " << stripe << " b using "
+			<< workers.size() << " session(s)" << endl;
+
+	mutex mtx;
+	condition_variable cv;
+	map<uint32_t, string> stripes;
+	uint32_t next = 0, written = 0;
+	bool stop = false;
+	exception_ptr error;
+	atomic<uint32_t> done { 0 };
+
+	auto listener = m_prog_l;
+	if (listener && !m_silent) {
+		listener(offset, length, false, true);
+	}
+
+	vector<thread> threads;
+
+	for (auto* worker : workers) {
+		worker->set_progress_listener([&done, last = uint32_t(0)] (uint32_t offset, uint32_t, bool, bool init) mutable {
+			if (init) {
+				last = offset;
+			} else if (offset != UINT32_MAX && offset > last) {
+				done += offset - last;
+				last = offset;
+			}
+		});
+
+		threads.emplace_back([&, worker] {
+			try {
+				unique_lock<mutex> lock(mtx);
+
+				while (true) {
+					cv.wait(lock, [&] { return stop || next >= count || next < written + window; });
+					if (stop || next >= count) {
+						break;
+					}
+
+					uint32_t i = next++;
+					lock.unlock();
+
+					ostringstream ostr;
+					worker->dump(offset + i * stripe, min(stripe, length - i * stripe), ostr);
+
+					lock.lock();
+					stripes[i] = ostr.str();
+					cv.notify_all();
+				}
+			} catch (...) {
+				lock_guard<mutex> lock(mtx);
+				if (!error) {
+					error = current_exception();
+				}
+				stop = true;
+				cv.notify_all();
+			}
+		});
+	}
+
+	for (uint32_t i = 0; i < count; ++i) {
+		unique_lock<mutex> lock(mtx);
+
+		while (!stop && !stripes.count(i)) {
+			cv.wait_for(lock, chrono::milliseconds(250));
+			if (listener && !m_silent) {
+				listener(offset + min(done.load(), length - 1), 0, false, false);
+			}
+		}
+
+		if (stop) {
+			break;
+		}
+
+		string data = move(stripes[i]);
+		stripes.erase(i);
+		++written;
+		cv.notify_all();
+		lock.unlock();
+
+		os.write(data.data(), data.size());
+
+		if (!i && data.size() >= sizeof(ps_header)) {
+			ps_header hdr(data);
+			if (hdr.hcs_valid()) {
+				image_detected(offset, hdr);
+			}
+		}
+	}
+
+	{
+		lock_guard<mutex> lock(mtx);
+		stop = true;
+		cv.notify_all();
+	}
+
+	for (auto& t : threads) {
+		t.join();
+	}
+
+	for (auto* worker : workers) {
+		worker->set_progress_listener();
+	}
+
+	m_prog_l = listener;
+
+	if (error) {
+		rethrow_exception(error);
+	}
+
+	if (listener && !m_silent) {
+		listener(offset + length, 0, false, false);
+	}
+}
+
 string rwx::read(uint32_t offset, uint32_t length)
 {
 	ostringstream ostr;
@@ -1563,6 +2631,103 @@ string rwx::read(uint32_t offset, uint32_t length)
 	return ostr.str();
 }
 
+vector<uint32_t> rwx::crc32(uint32_t offset, uint32_t length, uint32_t block)
+{
+	if (!probe_crc32()) {
+		require_capability(cap_crc32);
+	}
+
+	m_space.check_range(offset, length);
+
+	if (!block || (length % block)) {
+		throw invalid_argument("length must be a multiple of the block size");
+	}
+
+	init_progress(offset, length, false);
+	return crc32_impl(offset, length, block);
+}
+
+rwx::ranges rwx::dump_delta(const string& spec, const string& prev, ostream& os)
+{
+	require_capability(cap_read);
+	uint32_t offset, length;
+	parse_offset_size(*this, spec, offset, length, false);
+	return dump_delta(offset, length, prev, os);
+}
+
+rwx::ranges rwx::dump_delta(uint32_t offset, uint32_t length, const string& prev, ostream& os)
+{
+	require_capability(cap_read);
+	m_space.check_range(offset, length);
+
+	auto ioex = scoped_ios_exceptions::failbad(os);
+
+	uint32_t block = m_space.blocksize() ? m_space.blocksize() : 0x10000;
+	if (crc32_block_max()) {
+		block = min(block, crc32_block_max());
+	}
+
+	// blocks that are only partially contained in the requested
+	// range are always read.
+	uint32_t beg = align_right(offset, block);
+	uint32_t end = max(beg, align_left(offset + length, block));
+
+	vector<uint32_t> crcs;
+
+	if (end > beg) {
+		if (probe_crc32()) {
+			try {
+				logger::v() << "calculating crc32 of " << to_string((end - beg) / block)
+						<< " block(s) of " << block << " b" << endl;
+				crcs = crc32(beg, end - beg, block);
+			} catch (const interrupted& e) {
+				throw;
+			} catch (const exception& e) {
+				logger::w() << endl << "crc32 failed: " << e.what() << "; reading all blocks" << endl;
+			}
+		} else {
+			logger::w() << "crc32 not supported; reading all blocks" << endl;
+		}
+	}
+
+	if (crcs.empty()) {
+		beg = end = offset;
+	}
+
+	ranges changed;
+
+	auto add = [&changed] (uint32_t off, uint32_t len) {
+		if (!len) {
+			return;
+		} else if (!changed.empty() && (changed.back().first + changed.back().second) == off) {
+			changed.back().second += len;
+		} else {
+			changed.push_back({ off, len });
+		}
+	};
+
+	add(offset, beg - offset);
+
+	for (size_t i = 0; i < crcs.size(); ++i) {
+		uint32_t pos = beg + i * block - offset;
+		if ((pos + block) > prev.size() || crc_generic<boost::crc_32_type>(prev.data() + pos, block) != crcs[i]) {
+			add(offset + pos, block);
+		}
+	}
+
+	add(end, offset + length - end);
+
+	string image = prev.substr(0, length);
+	image.resize(length);
+
+	for (auto r : changed) {
+		image.replace(r.first - offset, r.second, read(r.first, r.second));
+	}
+
+	os.write(image.data(), image.size());
+	return changed;
+}
+
 void rwx::write(const string& spec, istream& is)
 {
 	require_capability(cap_write);
@@ -1611,13 +2776,29 @@ void rwx::write(uint32_t offset, const string& buf, uint32_t length)
 		throw user_error("non-aligned writes are not yet supported; alignment is " + to_string(lim.min));
 	}
 
-	string contents;
-	if (false && (capabilities() & cap_read)) {
-		contents = read(offset_w, length_w);
+	// to skip chunks that are already on the target, use crc32 values if
+	// possible. this is done before do_init(), since it may have to use
+	// different code on the target.
+
+	vector<uint32_t> crcs;
+
+	if (can_skip_write_chunk()) {
+		uint32_t crc_length = align_left(length_w, lim.max);
+
+		if (crc_length && (!crc32_block_max() || lim.max <= crc32_block_max()) && probe_crc32()) {
+			try {
+				crcs = crc32(offset_w, crc_length, lim.max);
+			} catch (const interrupted& e) {
+				throw;
+			} catch (const exception& e) {
+				logger::d() << endl << "crc32 failed: " << e.what() << endl;
+			}
+		}
 	}
 
+	uint32_t skipped = 0;
+
 	auto cleaner = make_cleaner();
-	do_init(offset_w, length_w, true);
 	init_progress(offset_w, length_w, true);
 
 	string buf_w;
@@ -1647,7 +2828,19 @@ void rwx::write(uint32_t offset, const string& buf, uint32_t length)
 		//string chunk(buf_w.substr(buf_w.size() - length_w, n));
 		string chunk(buf_w.substr(begin, n));
 
-		if (contents.empty() || contents.substr(begin, n) != chunk) {
+		bool same = false;
+
+		if (n == lim.max && !(begin % lim.max) && (begin / lim.max) < crcs.size()) {
+			same = (crc_generic<boost::crc_32_type>(chunk.data(), n) == crcs[begin / lim.max]);
+		}
+
+		if (same) {
+			skipped += n;
+		} else {
+			// only initialize once a chunk actually differs, so that
+			// nothing is uploaded if all chunks can be skipped.
+			do_init(offset_w - begin, buf_w.size(), true);
+
 			bool ok = false;
 
 			while (!ok) {
@@ -1693,6 +2886,10 @@ void rwx::write(uint32_t offset, const string& buf, uint32_t length)
 	}
 
 	update_progress(offset_w, length_w);
+
+	if (skipped) {
+		logger::v() << endl << "skipped " << skipped << " b of unchanged data" << endl;
+	}
 }
 
 void rwx::read_special(uint32_t offset, uint32_t length, ostream& os)
@@ -1744,6 +2941,11 @@ rwx::sp rwx::create(const interface::sp& intf, const string& type, bool safe)
 
 		if (!safe && bfc_bootassist::is_supported(intf, space)) {
 			return create_rwx<bfc_bootassist>(intf, space);
+		} else if (!safe && space.is_mem() && intf->version().has_opt("snmp:console")) {
+			auto ret = create_snmp_code_rwx(p, space);
+			if (ret) {
+				return ret;
+			}
 		}
 
 		auto ret = p->create_rwx(space, safe);
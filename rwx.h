@@ -21,6 +21,7 @@
 #define BCM2DUMP_DUMPER_H
 #include <memory>
 #include <string>
+#include <vector>
 #include "interface.h"
 #include "profile.h"
 #include "ps.h"
@@ -33,12 +34,15 @@ class rwx //: public rwx_writer
 	static unsigned constexpr cap_write = (1 << 1);
 	static unsigned constexpr cap_exec = (1 << 2);
 	static unsigned constexpr cap_special = (1 << 3);
+	static unsigned constexpr cap_crc32 = (1 << 4);
 	static unsigned constexpr cap_rw = cap_read | cap_write;
 	static unsigned constexpr cap_rwx = cap_rw | cap_exec;
 
 	typedef std::function<void(uint32_t, uint32_t, bool, bool)> progress_listener;
 	typedef std::function<void(uint32_t, const ps_header&)> image_listener;
 	typedef std::shared_ptr<rwx> sp;
+	// offset, length
+	typedef std::vector<std::pair<uint32_t, uint32_t>> ranges;
 	struct interrupted : public std::exception {};
 
 	struct limits
@@ -52,9 +56,37 @@ class rwx //: public rwx_writer
 		const uint32_t max;
 	};
 
+	// dump() writes its output on a separate thread, which is fed by a
+	// queue of chunks. these describe the queue's use during the last dump.
+	struct pipeline_stats
+	{
+		unsigned chunks = 0;
+		unsigned max_depth = 0;
+		double avg_depth = 0;
+		// number of times the queue was full, and the reader had to wait
+		unsigned stalls = 0;
+	};
+
+	// collected by dump(), for each chunk. times are in microseconds.
+	struct chunk_stats
+	{
+		// time taken to read the chunk, including retries
+		histogram latency;
+		// time until the first line of a chunk was parsed
+		histogram first_byte;
+		// time spent in parse_chunk_line()
+		histogram parse;
+		// time spent waiting for the device's output to settle
+		histogram wait_quiet;
+		histogram bytes;
+		histogram retries;
+	};
+
 	rwx();
 	virtual ~rwx();
 
+	virtual std::string name() const = 0;
+
 	virtual limits limits_read() const = 0;
 	virtual limits limits_write() const = 0;
 
@@ -65,6 +97,26 @@ class rwx //: public rwx_writer
 	void dump(uint32_t offset, uint32_t length, std::ostream& os, bool resume = false);
 	std::string read(uint32_t offset, uint32_t length);
 
+	// if true, several instances may read from the same device at the same
+	// time, using separate connections.
+	virtual bool can_dump_parallel() const
+	{ return false; }
+
+	// like dump(), but splits the range into stripes that are read in parallel,
+	// by this object, and all of `others`. these must be of the same type as
+	// this one, but use separate connections to the same device. falls back
+	// to dump() if can_dump_parallel() is false.
+	void dump_parallel(const std::string& spec, std::ostream& os, const std::vector<sp>& others, bool resume = false);
+	void dump_parallel(uint32_t offset, uint32_t length, std::ostream& os, const std::vector<sp>& others,
+			bool resume = false);
+
+	// dumps data, reading only the blocks that differ from `prev`, which
+	// must be a previous dump of the same range. returns the changed ranges.
+	ranges dump_delta(const std::string& spec, const std::string& prev, std::ostream& os);
+	ranges dump_delta(uint32_t offset, uint32_t length, const std::string& prev, std::ostream& os);
+	// returns the crc32 of each block
+	std::vector<uint32_t> crc32(uint32_t offset, uint32_t length, uint32_t block);
+
 	uint32_t read32(uint32_t offset)
 	{ return read_num<uint32_t>(offset); }
 
@@ -103,9 +155,24 @@ class rwx //: public rwx_writer
 	virtual void silent(bool silent) final
 	{ m_silent = silent; }
 
+	const pipeline_stats& get_pipeline_stats() const
+	{ return m_pipeline_stats; }
+
+	const chunk_stats& get_chunk_stats() const
+	{ return m_chunk_stats; }
+
+	void reset_stats()
+	{
+		m_chunk_stats = chunk_stats();
+		m_pipeline_stats = pipeline_stats();
+	}
+
 	static bool was_interrupted()
 	{ return s_sigint; }
 
+	static void clear_interrupted()
+	{ s_sigint = 0; }
+
 	protected:
 	void require_capability(unsigned cap);
 
@@ -135,21 +202,56 @@ class rwx //: public rwx_writer
 	virtual std::string read_special(uint32_t offset, uint32_t length) = 0;
 
 	virtual std::string read_chunk(uint32_t offset, uint32_t length) = 0;
+	// called before read_chunk(), with the parameters of the chunk that
+	// will be read after that (length is 0 for the last chunk).
+	virtual void hint_next_chunk(uint32_t offset, uint32_t length) {}
+	// if true, dump() may use any multiple of limits_read().min, up to
+	// limits_read().max, as chunk length.
+	virtual bool can_adapt_chunk_length() const
+	{ return false; }
 	// chunk length is guaranteed to be either min_length_write() or max_length_write()
 	virtual bool write_chunk(uint32_t offset, const std::string& chunk)
 	{ return false; }
+	// if false, write_chunk must be called for every chunk, even if the
+	// target already contains the same data.
+	virtual bool can_skip_write_chunk() const
+	{ return true; }
 
 	virtual bool exec_impl(uint32_t offset)
 	{ return false; }
 
+	virtual std::vector<uint32_t> crc32_impl(uint32_t offset, uint32_t length, uint32_t block)
+	{ return {}; }
+	// maximum block size supported by crc32_impl (0 = unlimited)
+	virtual uint32_t crc32_block_max() const
+	{ return 0; }
+	// like capabilities() & cap_crc32, but may query the device if
+	// support for crc32 can't be known in advance.
+	virtual bool probe_crc32()
+	{ return capabilities() & cap_crc32; }
+
+	// the flag is cleared once all rwx objects are gone, so that
+	// every thread that is using an rwx gets to see it.
 	static void throw_if_interrupted()
 	{
-		if (was_interrupted()) {
-			s_sigint = 0;
+		if (was_interrupted() && !s_no_interrupt) {
 			throw interrupted();
 		}
 	}
 
+	// ignores interrupts on the current thread, while in scope. used by
+	// cleanup code, which must restore the device's state after ctrl-c,
+	// and which runs in destructors, where throwing is fatal.
+	class scoped_no_interrupt
+	{
+		public:
+		scoped_no_interrupt()
+		{ ++s_no_interrupt; }
+
+		~scoped_no_interrupt()
+		{ --s_no_interrupt; }
+	};
+
 	virtual void update_progress(uint32_t offset, uint32_t length, bool write = false, bool init = false)
 	{
 		if (m_prog_l && !m_silent) {
@@ -179,6 +281,9 @@ class rwx //: public rwx_writer
 	image_listener m_img_l;
 	addrspace::part m_partition;
 	addrspace m_space;
+	// total number of chunk retries
+	unsigned m_retries = 0;
+	chunk_stats m_chunk_stats;
 
 	class scoped_cleaner
 	{
@@ -187,7 +292,15 @@ class rwx //: public rwx_writer
 		~scoped_cleaner()
 		{
 			if (m_rwx) {
-				m_rwx->do_cleanup();
+				scoped_no_interrupt guard;
+
+				// throwing from a destructor is fatal, and the cleanup is
+				// most likely to fail when we're here because of an error.
+				try {
+					m_rwx->do_cleanup();
+				} catch (const std::exception& e) {
+					logger::w() << "cleanup failed: " << e.what() << std::endl;
+				}
 			}
 		}
 
@@ -206,15 +319,21 @@ class rwx //: public rwx_writer
 	template<class T> T read_num(uint32_t offset)
 	{ return be_to_h(extract<T>(read(offset, sizeof(T)))); }
 
+	// skips the data that has already been written to `os`. returns false if
+	// there's nothing left to do.
+	bool skip_completed(std::ostream& os, uint32_t& offset, uint32_t& length);
+
 	static void handle_sigint(int signal)
 	{ s_sigint = 1; }
 
 	bool m_inited = false;
 	bool m_silent = false;
+	pipeline_stats m_pipeline_stats;
 
 	static unsigned s_count;
 	static sigh_type s_sighandler_orig;
 	static volatile sig_atomic_t s_sigint;
+	static thread_local unsigned s_no_interrupt;
 };
 
 }
@@ -0,0 +1,439 @@
+/**
+ * bcm2-utils
+ * Copyright (C) 2016 Joseph Lehner <joseph.c.lehner@gmail.com>
+ *
+ * bcm2-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bcm2-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bcm2-utils.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <climits>
+#include <algorithm>
+#include "session.h"
+#include "util.h"
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <csignal>
+#endif
+
+using namespace std;
+
+namespace bcm2dump {
+namespace {
+
+#ifndef _WIN32
+// a request consists of a u32 length, followed by the NUL-terminated
+// working directory of the client, and its arguments. the client's stdin,
+// stdout and stderr are passed along with the length field. the response
+// is the command's exit status, as a u32.
+
+const int stdfds[] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+const size_t stdfds_size = sizeof(stdfds);
+
+class socket_fd
+{
+	public:
+	socket_fd(const string& path)
+	{
+		if (path.size() >= sizeof(m_addr.sun_path)) {
+			throw user_error("socket path too long: " + path);
+		}
+
+		m_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (m_fd < 0) {
+			throw errno_error("socket");
+		}
+
+		memset(&m_addr, 0, sizeof(m_addr));
+		m_addr.sun_family = AF_UNIX;
+		strncpy(m_addr.sun_path, path.c_str(), sizeof(m_addr.sun_path) - 1);
+	}
+
+	explicit socket_fd(int fd) : m_fd(fd) {}
+
+	~socket_fd()
+	{
+		if (m_fd >= 0) {
+			close(m_fd);
+		}
+	}
+
+	void connect()
+	{
+		if (::connect(m_fd, addr(), sizeof(m_addr)) != 0) {
+			throw errno_error("connect: "s + m_addr.sun_path);
+		}
+	}
+
+	void listen()
+	{
+		// remove stale sockets
+		unlink(m_addr.sun_path);
+
+		// only the owner may connect, since requests are run with the
+		// privileges of the session (and share its connection).
+		mode_t mask = umask(0177);
+		int ret = ::bind(m_fd, addr(), sizeof(m_addr));
+		umask(mask);
+
+		if (ret != 0) {
+			throw errno_error("bind: "s + m_addr.sun_path);
+		} else if (::listen(m_fd, 4) != 0) {
+			throw errno_error("listen");
+		}
+	}
+
+	int accept()
+	{
+		int fd = ::accept(m_fd, nullptr, nullptr);
+		if (fd < 0) {
+			throw errno_error("accept");
+		}
+
+		return fd;
+	}
+
+	uid_t peer_uid() const
+	{
+#ifdef SO_PEERCRED
+		ucred cred;
+		socklen_t len = sizeof(cred);
+		if (getsockopt(m_fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) {
+			throw errno_error("getsockopt");
+		}
+
+		return cred.uid;
+#else
+		uid_t uid;
+		gid_t gid;
+		if (getpeereid(m_fd, &uid, &gid) != 0) {
+			throw errno_error("getpeereid");
+		}
+
+		return uid;
+#endif
+	}
+
+	void send(const string& buf, bool with_fds = false)
+	{
+		iovec iov = { const_cast<char*>(buf.data()), buf.size() };
+		msghdr msg = {};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+
+		char control[CMSG_SPACE(stdfds_size)] = {};
+
+		if (with_fds) {
+			msg.msg_control = control;
+			msg.msg_controllen = sizeof(control);
+
+			cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN(stdfds_size);
+			memcpy(CMSG_DATA(cmsg), stdfds, stdfds_size);
+		}
+
+		if (sendmsg(m_fd, &msg, MSG_NOSIGNAL) != ssize_t(buf.size())) {
+			throw errno_error("sendmsg");
+		}
+	}
+
+	string recv(size_t length, vector<int>* fds = nullptr)
+	{
+		string buf(length, '\0');
+		size_t received = 0;
+
+		while (received < length) {
+			iovec iov = { &buf[received], length - received };
+			msghdr msg = {};
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+
+			char control[CMSG_SPACE(stdfds_size)] = {};
+			if (fds) {
+				msg.msg_control = control;
+				msg.msg_controllen = sizeof(control);
+			}
+
+			ssize_t n = recvmsg(m_fd, &msg, 0);
+			if (n < 0) {
+				throw errno_error("recvmsg");
+			} else if (!n) {
+				throw runtime_error("connection closed");
+			}
+
+			for (cmsghdr* c = fds ? CMSG_FIRSTHDR(&msg) : nullptr; c; c = CMSG_NXTHDR(&msg, c)) {
+				if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+					size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+					const int* p = reinterpret_cast<const int*>(CMSG_DATA(c));
+					fds->insert(fds->end(), p, p + count);
+				}
+			}
+
+			received += n;
+			fds = nullptr;
+		}
+
+		return buf;
+	}
+
+	private:
+	sockaddr* addr()
+	{ return reinterpret_cast<sockaddr*>(&m_addr); }
+
+	int m_fd;
+	sockaddr_un m_addr;
+};
+
+// temporarily replaces stdin, stdout and stderr with the client's
+class redirector
+{
+	public:
+	redirector(const vector<int>& fds)
+	{
+		if (fds.size() != 3) {
+			throw runtime_error("expected 3 file descriptors, got " + to_string(fds.size()));
+		}
+
+		flush();
+
+		for (unsigned i = 0; i < 3; ++i) {
+			m_saved[i] = dup(stdfds[i]);
+			if (m_saved[i] < 0 || dup2(fds[i], stdfds[i]) < 0) {
+				throw errno_error("dup");
+			}
+		}
+	}
+
+	~redirector()
+	{
+		flush();
+
+		for (unsigned i = 0; i < 3; ++i) {
+			dup2(m_saved[i], stdfds[i]);
+			close(m_saved[i]);
+		}
+
+		// if the client went away, our streams will be in a bad state
+		cout.clear();
+		cerr.clear();
+		cin.clear();
+		clearerr(stdout);
+		clearerr(stderr);
+		clearerr(stdin);
+	}
+
+	private:
+	static void flush()
+	{
+		cout.flush();
+		cerr.flush();
+		fflush(stdout);
+		fflush(stderr);
+	}
+
+	int m_saved[3] = { -1, -1, -1 };
+};
+
+// while waiting for a request, ctrl-c ends the session. while handling
+// one, the handler installed by the request (if any) is in charge.
+class sigint_handler
+{
+	public:
+	sigint_handler()
+	{
+		struct sigaction sa;
+		memset(&sa, 0, sizeof(sa));
+		sigemptyset(&sa.sa_mask);
+		// no SA_RESTART, so that accept() fails with EINTR
+		sa.sa_handler = &handle_sigint;
+
+		if (sigaction(SIGINT, &sa, &m_saved) != 0) {
+			throw errno_error("sigaction");
+		}
+	}
+
+	~sigint_handler()
+	{
+		sigaction(SIGINT, &m_saved, nullptr);
+	}
+
+	static bool interrupted()
+	{ return s_sigint; }
+
+	private:
+	static void handle_sigint(int)
+	{ s_sigint = 1; }
+
+	struct sigaction m_saved;
+	static volatile sig_atomic_t s_sigint;
+};
+
+volatile sig_atomic_t sigint_handler::s_sigint = 0;
+#endif
+}
+
+#ifndef _WIN32
+void session::serve(const string& path, const handler& f)
+{
+	char cwd[PATH_MAX];
+	if (!getcwd(cwd, sizeof(cwd))) {
+		throw errno_error("getcwd");
+	}
+
+	// requests change the working directory, so the socket path must
+	// not depend on it.
+	string abspath = (path.empty() || path[0] != '/') ? cwd + "/"s + path : path;
+
+	int cwd_fd = open(".", O_RDONLY);
+	if (cwd_fd < 0) {
+		throw errno_error("open: "s + cwd);
+	}
+
+	socket_fd sock(abspath);
+	sock.listen();
+
+	// writing to a client that has gone away must not kill the session
+	signal(SIGPIPE, SIG_IGN);
+
+	logger::i() << "serving session at " << abspath << endl;
+
+	while (true) {
+		int fd = -1;
+
+		try {
+			sigint_handler sigint;
+			if (!sigint_handler::interrupted()) {
+				fd = sock.accept();
+			}
+		} catch (const errno_error& e) {
+			if (!e.interrupted()) {
+				throw;
+			}
+		}
+
+		if (fd < 0) {
+			if (sigint_handler::interrupted()) {
+				break;
+			}
+
+			continue;
+		}
+
+		socket_fd client(fd);
+		vector<int> fds;
+		int status = 1;
+
+		try {
+			if (client.peer_uid() != geteuid()) {
+				logger::w() << "session: rejecting client with uid " << client.peer_uid() << endl;
+				continue;
+			}
+		} catch (const exception& e) {
+			logger::w() << "session: " << e.what() << endl;
+			continue;
+		}
+
+		try {
+			auto length = be_to_h(extract<uint32_t>(client.recv(4, &fds)));
+			auto buf = client.recv(length);
+			vector<string> args;
+
+			for (size_t beg = 0; beg <= buf.size();) {
+				auto end = min(buf.find('\0', beg), buf.size());
+				args.push_back(buf.substr(beg, end - beg));
+				beg = end + 1;
+			}
+
+			if (args.size() < 2) {
+				throw runtime_error("invalid request");
+			}
+
+			if (chdir(args[0].c_str()) != 0) {
+				throw errno_error("chdir: " + args[0]);
+			}
+
+			args.erase(args.begin());
+
+			logger::d() << "session: running";
+			for (size_t i = 1; i < args.size(); ++i) {
+				logger::d() << " " << args[i];
+			}
+			logger::d() << endl;
+
+			redirector r(fds);
+			status = f(args);
+		} catch (const exception& e) {
+			logger::w() << "session: " << e.what() << endl;
+		}
+
+		for (int fd : fds) {
+			close(fd);
+		}
+
+		if (fchdir(cwd_fd) != 0) {
+			throw errno_error("fchdir: "s + cwd);
+		}
+
+		try {
+			client.send(to_buf(h_to_be(uint32_t(status))));
+		} catch (const exception& e) {
+			logger::d() << "session: " << e.what() << endl;
+		}
+	}
+
+	close(cwd_fd);
+	unlink(abspath.c_str());
+	logger::i() << "session ended" << endl;
+}
+
+int session::run(const string& path, const vector<string>& args)
+{
+	char cwd[PATH_MAX];
+	if (!getcwd(cwd, sizeof(cwd))) {
+		throw errno_error("getcwd");
+	}
+
+	string buf = cwd;
+	for (auto arg : args) {
+		buf += '\0' + arg;
+	}
+
+	socket_fd sock(path);
+	sock.connect();
+	sock.send(to_buf(h_to_be(uint32_t(buf.size()))), true);
+	sock.send(buf);
+
+	return be_to_h(extract<uint32_t>(sock.recv(4)));
+}
+#else
+void session::serve(const string& path, const handler& f)
+{
+	throw user_error("sessions are not supported on this platform");
+}
+
+int session::run(const string& path, const vector<string>& args)
+{
+	throw user_error("sessions are not supported on this platform");
+}
+#endif
+}
@@ -0,0 +1,47 @@
+/**
+ * bcm2-utils
+ * Copyright (C) 2016 Joseph Lehner <joseph.c.lehner@gmail.com>
+ *
+ * bcm2-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bcm2-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bcm2-utils.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef BCM2DUMP_SESSION_H
+#define BCM2DUMP_SESSION_H
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace bcm2dump {
+
+// A session is a long-running bcm2dump process that owns an interface,
+// and runs commands on behalf of other bcm2dump processes, which connect
+// to it using a local socket. The client's stdin, stdout and stderr are
+// passed along with each request, so output ends up where it would if the
+// client had run the command itself.
+class session
+{
+	public:
+	typedef std::function<int(std::vector<std::string>&)> handler;
+
+	// serve requests until interrupted while waiting for one. requests are
+	// handled one at a time.
+	static void serve(const std::string& path, const handler& f);
+	// run a command on the session at `path`, and return its exit status.
+	static int run(const std::string& path, const std::vector<std::string>& args);
+};
+
+}
+
+#endif
@@ -12,6 +12,10 @@ const string cd_engr_mem_size = cd_engr_base + ".2.0";
 const string cd_engr_mem_data = cd_engr_base + ".3.0";
 const string cd_engr_mem_cmd  = cd_engr_base + ".4.0";
 
+// words that are missing after a pipelined read are read one at a time. if
+// there are more than this, the agent is unlikely to answer those either.
+const unsigned max_word_retries = 8;
+
 class snmp_bfc : public snmp
 {
 	public:
@@ -24,8 +28,11 @@ class snmp_bfc : public snmp
 class snmp_bfc_ram : public rwx
 {
 	public:
+	virtual string name() const override
+	{ return "snmp_bfc_ram"; }
+
 	virtual limits limits_read() const override
-	{ return { 4, 4, 4 }; }
+	{ return { 4, 4, m_read_window > 1 ? 4u * 64 : 4u }; }
 
 	virtual limits limits_write() const override
 	{ return { 1, 4, 4}; }
@@ -36,6 +43,7 @@ class snmp_bfc_ram : public rwx
 	virtual void set_interface(const interface::sp& intf) override
 	{
 		rwx::set_interface(intf);
+		m_read_window = intf->version().get_opt_num("snmp:read_window", 16);
 
 		try {
 			// check for exec support
@@ -55,12 +63,51 @@ class snmp_bfc_ram : public rwx
 
 	virtual std::string read_chunk(uint32_t offset, uint32_t length) override
 	{
-		run_mem_command(offset, length, CMD_READ);
-		// data is a 32-bit int that represents the data at this offset
-		auto data = intf()->get(cd_engr_mem_data);
-		// FIXME this shouldn't be here
-		update_progress(offset, length);
-		return to_buf(h_to_be<uint32_t>(data.integer));
+		if (length == 4) {
+			return read_word(offset);
+		}
+
+		// every word takes a set and a get, so instead of waiting for
+		// each response, we keep several requests in flight.
+
+		string ret(length, '\0');
+		vector<bool> done(length / 4);
+
+		try {
+			snmp::pipeline p(*intf(), m_read_window);
+
+			for (uint32_t i = 0; i < length; i += 4) {
+				p.set(mem_command_vars(offset + i, 4, CMD_READ));
+				// the address is read back, to make sure that the data
+				// belongs to this request.
+				p.get({ cd_engr_mem_addr, cd_engr_mem_data }, [&, i] (const vector<snmp::var>& vars) {
+					if (vars.size() == 2 && uint32_t(vars[0].integer) == offset + i) {
+						ret.replace(i, 4, to_buf(h_to_be<uint32_t>(vars[1].integer)));
+						done[i / 4] = true;
+						update_progress(offset + i, 4);
+					}
+				});
+			}
+
+			p.flush();
+		} catch (const exception& e) {
+			logger::d() << "pipelined read of 0x" << to_hex(offset) << "," << length << " failed: " << e.what() << endl;
+		}
+
+		auto missing = count(done.begin(), done.end(), false);
+		if (missing > max_word_retries) {
+			throw runtime_error("pipelined read of 0x" + to_hex(offset) + "," + to_string(length)
+					+ " failed: " + to_string(missing) + " word(s) missing");
+		}
+
+		for (uint32_t i = 0; i < length; i += 4) {
+			if (!done[i / 4]) {
+				++m_retries;
+				ret.replace(i, 4, read_word(offset + i));
+			}
+		}
+
+		return ret;
 	}
 
 	virtual std::string read_special(uint32_t offset, uint32_t length) override
@@ -91,7 +138,17 @@ class snmp_bfc_ram : public rwx
 	}
 
 	private:
-	void run_mem_command(uint32_t offset, uint32_t length, uint32_t command, uint32_t value = 0)
+	string read_word(uint32_t offset)
+	{
+		run_mem_command(offset, 4, CMD_READ);
+		// data is a 32-bit int that represents the data at this offset
+		auto data = intf()->get(cd_engr_mem_data);
+		// FIXME this shouldn't be here
+		update_progress(offset, 4);
+		return to_buf(h_to_be<uint32_t>(data.integer));
+	}
+
+	vector<pair<string, snmp::var>> mem_command_vars(uint32_t offset, uint32_t length, uint32_t command, uint32_t value = 0)
 	{
 		vector<pair<string, snmp::var>> vars {
 			{ cd_engr_mem_addr, { offset, ASN_UNSIGNED }},
@@ -103,8 +160,12 @@ class snmp_bfc_ram : public rwx
 		}
 
 		vars.push_back({ cd_engr_mem_cmd, { command, ASN_INTEGER }});
+		return vars;
+	}
 
-		intf()->set(vars);
+	void run_mem_command(uint32_t offset, uint32_t length, uint32_t command, uint32_t value = 0)
+	{
+		intf()->set(mem_command_vars(offset, length, command, value));
 	}
 
 	bcm2dump::sp<snmp> intf()
@@ -113,9 +174,169 @@ class snmp_bfc_ram : public rwx
 	}
 
 	unsigned m_capabilities = cap_rw;
+	unsigned m_read_window = 1;
 };
 
 bool snmp_initialized = false;
+
+snmp_pdu* make_get_pdu(const vector<string>& oids)
+{
+	snmp_pdu* pdu = snmp_pdu_create(SNMP_MSG_GET);
+
+	for (string o : oids) {
+		oid oidbuf[MAX_OID_LEN];
+		size_t oidlen = ARRAY_SIZE(oidbuf);
+
+		read_objid(o.c_str(), oidbuf, &oidlen);
+		snmp_add_null_var(pdu, oidbuf, oidlen);
+	}
+
+	return pdu;
+}
+
+snmp_pdu* make_set_pdu(const vector<pair<string, snmp::var>>& values)
+{
+	snmp_pdu* pdu = snmp_pdu_create(SNMP_MSG_SET);
+
+	for (auto p : values) {
+		oid oidbuf[MAX_OID_LEN];
+		size_t oidlen = ARRAY_SIZE(oidbuf);
+
+		read_objid(p.first.c_str(), oidbuf, &oidlen);
+
+		if (p.second.type == ASN_OCTET_STR) {
+			snmp_pdu_add_variable(pdu, oidbuf, oidlen, p.second.type, p.second.str.data(), p.second.str.size());
+		} else if (p.second.type == ASN_INTEGER || p.second.type == ASN_UNSIGNED) {
+			auto value = p.second.integer;
+			snmp_pdu_add_variable(pdu, oidbuf, oidlen, p.second.type, &value, sizeof(value));
+		} else {
+			snmp_free_pdu(pdu);
+			throw runtime_error("unhandled variable type");
+		}
+	}
+
+	return pdu;
+}
+
+vector<snmp::var> parse_vars(snmp_pdu* response)
+{
+	vector<snmp::var> ret;
+
+	for (auto rvar = response->variables; rvar; rvar = rvar->next_variable) {
+		if (rvar->type == ASN_INTEGER || rvar->type == ASN_UNSIGNED) {
+			ret.push_back(snmp::var(*rvar->val.integer, rvar->type));
+		} else if (rvar->type == ASN_OCTET_STR) {
+			ret.push_back(snmp::var(rvar->val.string, rvar->val_len, rvar->type));
+		} else {
+			// FIXME
+			print_variable(rvar->name, rvar->name_length, rvar);
+			throw runtime_error("unhandled variable type");
+		}
+	}
+
+	return ret;
+}
+}
+
+struct snmp::pipeline::request
+{
+	pipeline* p;
+	callback cb;
+};
+
+snmp::pipeline::pipeline(snmp& s, unsigned window)
+: m_snmp(s), m_window(max(window, 1u))
+{}
+
+snmp::pipeline::~pipeline()
+{
+	// the callbacks of outstanding requests may refer to
+	// objects that are about to go away.
+	try {
+		wait(0);
+	} catch (...) {
+	}
+}
+
+void snmp::pipeline::set(const vector<pair<string, var>>& values)
+{
+	send(make_set_pdu(values), nullptr);
+}
+
+void snmp::pipeline::get(const vector<string>& oids, const callback& cb)
+{
+	send(make_get_pdu(oids), cb);
+}
+
+void snmp::pipeline::flush()
+{
+	wait(0);
+
+	if (!m_error.empty()) {
+		string error = m_error;
+		m_error.clear();
+		throw runtime_error("snmp: " + error);
+	}
+}
+
+void snmp::pipeline::send(snmp_pdu* pdu, const callback& cb)
+{
+	wait(m_window - 1);
+
+	auto req = new request { this, cb };
+	if (!snmp_async_send(m_snmp.m_ss, pdu, &pipeline::on_response, req)) {
+		delete req;
+		snmp_free_pdu(pdu);
+		throw runtime_error("snmp_async_send failed");
+	}
+
+	++m_outstanding;
+}
+
+void snmp::pipeline::wait(unsigned max_outstanding)
+{
+	while (m_outstanding > max_outstanding) {
+		int fds = 0, block = 1;
+		fd_set fdset;
+		timeval timeout;
+
+		FD_ZERO(&fdset);
+		snmp_select_info(&fds, &fdset, &timeout, &block);
+		fds = select(fds, &fdset, nullptr, nullptr, block ? nullptr : &timeout);
+
+		if (fds < 0) {
+			if (errno != EINTR) {
+				throw errno_error("select");
+			}
+		} else if (fds) {
+			snmp_read(&fdset);
+		} else {
+			snmp_timeout();
+		}
+	}
+}
+
+int snmp::pipeline::on_response(int op, snmp_session*, int, snmp_pdu* pdu, void* magic)
+{
+	unique_ptr<request> req(static_cast<request*>(magic));
+	pipeline* p = req->p;
+	--p->m_outstanding;
+
+	try {
+		if (op != NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE) {
+			throw runtime_error("request failed (op=" + to_string(op) + ")");
+		} else if (pdu->errstat != SNMP_ERR_NOERROR) {
+			throw runtime_error(snmp_errstring(pdu->errstat));
+		} else if (req->cb) {
+			req->cb(parse_vars(pdu));
+		}
+	} catch (const exception& e) {
+		if (p->m_error.empty()) {
+			p->m_error = e.what();
+		}
+	}
+
+	return 1;
 }
 
 snmp::snmp(string peer)
@@ -151,36 +372,12 @@ snmp::var snmp::get(const std::string& oid) const
 
 vector<snmp::var> snmp::get(const vector<string>& oids) const
 {
-	snmp_pdu* pdu = snmp_pdu_create(SNMP_MSG_GET);
-
-	for (string o : oids) {
-		oid oidbuf[MAX_OID_LEN];
-		size_t oidlen = ARRAY_SIZE(oidbuf);
-
-		read_objid(o.c_str(), oidbuf, &oidlen);
-		snmp_add_null_var(pdu, oidbuf, oidlen);
-	}
-
 	snmp_pdu* response;
-	int status = snmp_synch_response(m_ss, pdu, &response);
+	int status = snmp_synch_response(m_ss, make_get_pdu(oids), &response);
 	cleaner c { [&response]() { snmp_free_pdu(response); }};
 
 	if (status == STAT_SUCCESS && response->errstat == SNMP_ERR_NOERROR) {
-		vector<snmp::var> ret;
-
-		for (auto rvar = response->variables; rvar; rvar = rvar->next_variable) {
-			if (rvar->type == ASN_INTEGER || rvar->type == ASN_UNSIGNED) {
-				ret.push_back(var(*rvar->val.integer, rvar->type));
-			} else if (rvar->type == ASN_OCTET_STR) {
-				ret.push_back(var(rvar->val.string, rvar->val_len, rvar->type));
-			} else {
-				// FIXME
-				print_variable(rvar->name, rvar->name_length, rvar);
-				throw runtime_error("unhandled variable type");
-			}
-		}
-
-		return ret;
+		return parse_vars(response);
 	}
 
 	throw runtime_error("snmp::get failed");
@@ -193,26 +390,8 @@ void snmp::set(const string& oid, const var& value)
 
 void snmp::set(const vector<pair<string, var>>& values)
 {
-	snmp_pdu* pdu = snmp_pdu_create(SNMP_MSG_SET);
-
-	for (auto p : values) {
-		oid oidbuf[MAX_OID_LEN];
-		size_t oidlen = ARRAY_SIZE(oidbuf);
-
-		read_objid(p.first.c_str(), oidbuf, &oidlen);
-
-		if (p.second.type == ASN_OCTET_STR) {
-			snmp_pdu_add_variable(pdu, oidbuf, oidlen, p.second.type, p.second.str.data(), p.second.str.size());
-		} else if (p.second.type == ASN_INTEGER || p.second.type == ASN_UNSIGNED) {
-			auto value = p.second.integer;
-			snmp_pdu_add_variable(pdu, oidbuf, oidlen, p.second.type, &value, sizeof(value));
-		} else {
-			throw runtime_error("unhandled variable type");
-		}
-	}
-
 	snmp_pdu* response;
-	int status = snmp_synch_response(m_ss, pdu, &response);
+	int status = snmp_synch_response(m_ss, make_set_pdu(values), &response);
 	cleaner c { [&response]() { snmp_free_pdu(response); }};
 
 	if (status != STAT_SUCCESS) {
@@ -2,6 +2,7 @@
 #define BCM2DUMP_SNMP_H
 #include <net-snmp/net-snmp-config.h>
 #include <net-snmp/net-snmp-includes.h>
+#include <functional>
 #include "interface.h"
 #include "rwx.h"
 
@@ -29,6 +30,36 @@ class snmp : public interface
 		u_char type;
 	};
 
+	// Sends requests without waiting for their responses, keeping up to
+	// `window` of them in flight. Agents handle requests in the order they
+	// arrive, so a get may depend on a preceding set, but callers should
+	// verify this, since datagrams may be reordered or lost.
+	class pipeline
+	{
+		public:
+		typedef std::function<void(const std::vector<var>&)> callback;
+
+		pipeline(snmp& s, unsigned window);
+		~pipeline();
+
+		void set(const std::vector<std::pair<std::string, var>>& values);
+		void get(const std::vector<std::string>& oids, const callback& cb);
+		// waits for all outstanding requests. throws if any of them failed.
+		void flush();
+
+		private:
+		struct request;
+
+		static int on_response(int op, snmp_session* ss, int reqid, snmp_pdu* pdu, void* magic);
+		void send(snmp_pdu* pdu, const callback& cb);
+		void wait(unsigned max_outstanding);
+
+		snmp& m_snmp;
+		unsigned m_window;
+		unsigned m_outstanding = 0;
+		std::string m_error;
+	};
+
 	snmp(std::string peer);
 
 	virtual std::string name() const override
@@ -0,0 +1,339 @@
+/**
+ * bcm2-utils
+ * Copyright (C) 2016 Joseph C. Lehner <joseph.c.lehner@gmail.com>
+ *
+ * bcm2-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bcm2-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bcm2-utils.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <chrono>
+#include <vector>
+#include "hexline.h"
+#include "util.h"
+using namespace std;
+using namespace bcm2dump;
+
+// Checks the hexdump line parsers against the sscanf/split()/hex_cast
+// based code they replace, and compares their speed.
+
+namespace {
+
+class failed_test : public runtime_error
+{
+	public:
+	explicit failed_test(const string& msg) : runtime_error(msg) {}
+};
+
+// the old parsers; return false where the originals would have thrown
+
+bool old_bfc_ram(string_view line, uint32_t offset, string& chunk)
+{
+	const char* fmts[] = {
+		"%x: %x  %x  %x  %x",
+		"%u: %u  %u  %u  %u",
+	};
+
+	char buf[128];
+	size_t len = min(line.size(), sizeof(buf) - 1);
+	memcpy(buf, line.data(), len);
+	buf[len] = '\0';
+
+	uint32_t data[4];
+	uint32_t off = 0;
+	int n;
+
+	for (const char* fmt : fmts) {
+		n = sscanf(buf, fmt, &off, &data[0],
+				&data[1], &data[2], &data[3]);
+
+		if (n > 1 && off == offset) {
+			break;
+		}
+	}
+
+	if (n <= 0 || off != offset) {
+		return false;
+	}
+
+	for (int i = 0; i < (n - 1); ++i) {
+		append_buf(chunk, be_to_h(data[i]));
+	}
+
+	return true;
+}
+
+bool old_bfc_flash(string_view line, string& chunk)
+{
+	bool empty = true;
+
+	while (!line.empty()) {
+		auto i = line.find(' ');
+		string_view num = line.substr(0, i);
+		line.remove_prefix(i != string_view::npos ? i + 1 : line.size());
+
+		if (num.empty()) {
+			continue;
+		}
+
+		try {
+			append_buf(chunk, be_to_h(lexical_cast<uint32_t>(num.to_string(), 16)));
+		} catch (const exception& e) {
+			return false;
+		}
+
+		empty = false;
+	}
+
+	return !empty;
+}
+
+bool old_code(string_view line, string& chunk)
+{
+	try {
+		while (true) {
+			auto i = line.find(':');
+			append_buf(chunk, h_to_be(lexical_cast<uint32_t>(line.substr(0, i).to_string(), 16)));
+			if (i == string_view::npos) {
+				return true;
+			}
+			line.remove_prefix(i + 1);
+		}
+	} catch (const exception& e) {
+		return false;
+	}
+}
+
+// the new ones, from hexline.h
+
+bool new_bfc_ram(string_view line, uint32_t offset, string& chunk)
+{
+	uint32_t off;
+	return hexline::parse_bfc_ram_line(line, offset, off, chunk) && off == offset;
+}
+
+string hex(uint32_t n, bool upper = false)
+{
+	char buf[9];
+	snprintf(buf, sizeof(buf), upper ? "%08X" : "%08x", n);
+	return buf;
+}
+
+struct lines
+{
+	vector<string> ram;
+	vector<string> ram_dec;
+	vector<string> flash;
+	vector<string> code;
+};
+
+lines make_lines(unsigned count)
+{
+	lines ret;
+
+	for (unsigned i = 0; i < count; ++i) {
+		uint32_t offset = 0x80000000 + i * 16;
+		uint32_t w[4];
+		for (auto& n : w) {
+			n = (uint32_t(rand()) << 16) ^ rand();
+		}
+
+		string ram = hex(offset) + ": ";
+		string dec = to_string(offset) + ": ";
+		string flash;
+		string code;
+
+		for (unsigned k = 0; k < 4; ++k) {
+			ram += hex(w[k], k & 1) + "  ";
+			dec += to_string(w[k]) + "  ";
+			flash += " " + hex(w[k]);
+			code += (k ? ":" : "") + to_hex(w[k], 0);
+		}
+
+		ret.ram.push_back(ram + " | ........ ........");
+		ret.ram_dec.push_back(dec);
+		ret.flash.push_back(flash);
+		ret.code.push_back(code);
+	}
+
+	return ret;
+}
+
+void check(const string& name, const string& line, bool old_ok, bool new_ok,
+		const string& old_chunk, const string& new_chunk)
+{
+	if (old_ok != new_ok || (old_ok && old_chunk != new_chunk)) {
+		throw failed_test(name + ": mismatch for '" + line + "'\n"
+				+ "old: " + (old_ok ? to_hex(old_chunk) : "error") + "\n"
+				+ "new: " + (new_ok ? to_hex(new_chunk) : "error"));
+	}
+}
+
+void test_bfc_ram(const lines& l)
+{
+	const vector<string> odd = {
+		"80000000: 00000001  00000002",
+		"80000000:",
+		"80000000 00000001",
+		"80000000: 00000001 | ....",
+		"  80000000:   00000001\t00000002  ",
+		"2147483648: 1  2  3  4",
+		"2147483648: 1  2  3  4  5  6",
+		"x80000000: 00000001",
+		"80000010: 00000001",
+	};
+
+	for (auto* v : { &l.ram, &l.ram_dec, &odd }) {
+		for (size_t i = 0; i < v->size(); ++i) {
+			uint32_t offset = 0x80000000 + (v == &odd ? 0 : i * 16);
+			string a, b;
+			bool ra = old_bfc_ram((*v)[i], offset, a);
+			bool rb = new_bfc_ram((*v)[i], offset, b);
+			check("bfc_ram", (*v)[i], ra, rb, a, b);
+		}
+	}
+}
+
+void test_bfc_flash(const lines& l)
+{
+	vector<string> all = l.flash;
+	all.insert(all.end(), {
+		"00000001 00000002",
+		"  1  2 ",
+		"",
+		" ",
+		"0000000g",
+		"1 2 x",
+		"123456789",
+	});
+
+	for (auto line : all) {
+		string a, b;
+		bool ra = old_bfc_flash(line, a);
+		bool rb = hexline::parse_bfc_flash_line(line, false, b);
+		check("bfc_flash", line, ra, rb, a, b);
+	}
+
+	// direct reads print bytes; on failure, the chunk must be left as it was
+	const vector<pair<string, string>> bytes = {
+		{ "01 02 ff", "\x01\x02\xff"s },
+		{ " 0  a ", "\x00\x0a"s },
+		{ "01 100", "" },
+		{ "01 x", "" },
+		{ "", "" },
+	};
+
+	for (auto& t : bytes) {
+		string chunk = "x";
+		bool ok = hexline::parse_bfc_flash_line(t.first, true, chunk);
+		check("bfc_flash bytes", t.first, !t.second.empty(), ok, "x" + t.second, chunk);
+
+		if (!ok && chunk != "x") {
+			throw failed_test("bfc_flash bytes: chunk modified for '" + t.first + "'");
+		}
+	}
+}
+
+void test_code(const lines& l)
+{
+	vector<string> all = l.code;
+	all.insert(all.end(), {
+		"1:2:3:4",
+		"1::3",
+		"1:2:",
+		"",
+		"1:x",
+		"123456789:1",
+	});
+
+	for (auto line : all) {
+		string a, b;
+		bool ra = old_code(line, a);
+		bool rb = hexline::parse_code_line(line, b);
+		check("code", line, ra, rb, a, b);
+	}
+}
+
+template<class F> void bench(const string& name, const vector<string>& lines, unsigned rounds, F f)
+{
+	string chunk;
+	chunk.reserve(lines.size() * 16);
+
+	auto start = chrono::steady_clock::now();
+
+	for (unsigned i = 0; i < rounds; ++i) {
+		chunk.clear();
+		for (size_t k = 0; k < lines.size(); ++k) {
+			f(lines[k], 0x80000000 + k * 16, chunk);
+		}
+	}
+
+	double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	double count = lines.size() * rounds;
+
+	printf("%-20s %8.1f ns/line %8.1f MB/s\n", name.c_str(), elapsed * 1e9 / count,
+			chunk.size() * rounds / elapsed / 1e6);
+}
+
+void bench_all(const lines& l, unsigned rounds)
+{
+	bench("bfc_ram (sscanf)", l.ram, rounds, [] (string_view line, uint32_t offset, string& chunk) {
+		old_bfc_ram(line, offset, chunk);
+	});
+	bench("bfc_ram", l.ram, rounds, [] (string_view line, uint32_t offset, string& chunk) {
+		new_bfc_ram(line, offset, chunk);
+	});
+	bench("bfc_ram dec (sscanf)", l.ram_dec, rounds, [] (string_view line, uint32_t offset, string& chunk) {
+		old_bfc_ram(line, offset, chunk);
+	});
+	bench("bfc_ram dec", l.ram_dec, rounds, [] (string_view line, uint32_t offset, string& chunk) {
+		new_bfc_ram(line, offset, chunk);
+	});
+	bench("bfc_flash (old)", l.flash, rounds, [] (string_view line, uint32_t, string& chunk) {
+		old_bfc_flash(line, chunk);
+	});
+	bench("bfc_flash", l.flash, rounds, [] (string_view line, uint32_t, string& chunk) {
+		hexline::parse_bfc_flash_line(line, false, chunk);
+	});
+	bench("code (old)", l.code, rounds, [] (string_view line, uint32_t, string& chunk) {
+		old_code(line, chunk);
+	});
+	bench("code", l.code, rounds, [] (string_view line, uint32_t, string& chunk) {
+		hexline::parse_code_line(line, chunk);
+	});
+}
+}
+
+int main(int argc, char** argv)
+{
+	// with an argument, run a benchmark with that many rounds
+	lines l = make_lines(argc > 1 ? 1000 : 100);
+
+	try {
+		test_bfc_ram(l);
+		test_bfc_flash(l);
+		test_code(l);
+	} catch (const exception& e) {
+		cerr << "TEST FAILED" << endl << e.what() << endl;
+		return 1;
+	}
+
+	if (argc > 1) {
+		bench_all(l, lexical_cast<unsigned>(argv[1]));
+	}
+
+	return 0;
+}
@@ -0,0 +1,57 @@
+#!/bin/sh
+# Dumps and writes data using an emulated device, verifies the results and
+# prints the time taken for each step. Usage:
+#
+#   ./emu-bench.sh [<bcm2emu options> ...]
+#
+# e.g. ./emu-bench.sh -b 11520 -l 5 -n 0.001
+#
+# If SNMP_PORT is set, the emulator's SNMP agent is started on that port,
+# and ram is also dumped using the snmp interface. This requires bcm2dump
+# to be built with WITH_SNMP=1.
+#
+# Run `make bcm2dump bcm2emu` in the parent directory first.
+
+set -e
+
+BCM2DUMP=${BCM2DUMP:-../bcm2dump}
+BCM2EMU=${BCM2EMU:-../bcm2emu}
+PORT=${PORT:-2380}
+SIZE=${SIZE:-16384}
+# writes are done one word at a time, so keep this small
+WRITE_SIZE=${WRITE_SIZE:-1024}
+
+tmp=$(mktemp -d)
+trap 'kill $pid 2>/dev/null; rm -rf $tmp' EXIT
+
+head -c $SIZE /dev/urandom > $tmp/ram.bin
+head -c $SIZE /dev/urandom > $tmp/flash.bin
+head -c $WRITE_SIZE /dev/urandom > $tmp/write.bin
+
+$BCM2EMU -r $tmp/ram.bin -f $tmp/flash.bin ${SNMP_PORT:+-S $SNMP_PORT} "$@" $PORT &
+pid=$!
+sleep 1
+
+run() {
+	name=$1
+	shift
+	start=$(date +%s%N)
+	$BCM2DUMP -q -P generic "$@"
+	end=$(date +%s%N)
+	echo "$name: $(( (end - start) / 1000000 )) ms"
+}
+
+run "dump ram" -F dump 127.0.0.1,$PORT ram 0x80000000,$SIZE $tmp/out.bin
+cmp $tmp/out.bin $tmp/ram.bin
+
+run "dump flash" -F dump 127.0.0.1,$PORT flash image1,$SIZE $tmp/out.bin
+cmp $tmp/out.bin $tmp/flash.bin
+
+run "write ram" write 127.0.0.1,$PORT ram 0x80100000 $tmp/write.bin
+run "dump ram (written)" -F dump 127.0.0.1,$PORT ram 0x80100000,$WRITE_SIZE $tmp/out.bin
+cmp $tmp/out.bin $tmp/write.bin
+
+if [ -n "$SNMP_PORT" ]; then
+	run "dump ram (snmp)" -F dump snmp:127.0.0.1:$SNMP_PORT ram 0x80000000,$SIZE $tmp/out.bin
+	cmp $tmp/out.bin $tmp/ram.bin
+fi
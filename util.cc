@@ -17,6 +17,8 @@
  *
  */
 
+#include <mutex>
+#include <map>
 #include "profile.h"
 #include "util.h"
 using namespace std;
@@ -70,6 +72,10 @@ bool is_unescaped(const string& str, string::size_type pos)
 	return ret;
 }
 
+// guards the log file, the i/o context lines, and our log streams. it's
+// recursive, since log_io writes to the log streams.
+recursive_mutex log_mutex;
+
 // inspired by http://wordaligned.org/articles/cpp-streambufs
 //
 // we don't care if the operations on the ofstream's buffer fail,
@@ -78,33 +84,72 @@ bool is_unescaped(const string& str, string::size_type pos)
 class logbuf : public streambuf
 {
 	public:
-	logbuf(ostream& os)
+	// if `os` is null, output goes to the log file only
+	logbuf(ostream* os)
 	: m_os(os)
 	{}
 
 	static ofstream file;
 
 	protected:
+	// output is collected per thread, and written one line at a time,
+	// so that lines logged by different threads don't get mixed up.
 	virtual int overflow(int c) override
 	{
-		file.rdbuf()->sputc(c);
-		return m_os.rdbuf()->sputc(c);
+		if (c == traits_type::eof()) {
+			return traits_type::not_eof(c);
+		}
+
+		string& line = pending();
+		line += traits_type::to_char_type(c);
+
+		if (c == '\n') {
+			write_line(line);
+		}
+
+		return c;
 	}
 
 	virtual int sync() override
 	{
+		write_line(pending());
+
+		lock_guard<recursive_mutex> lock(log_mutex);
 		file.rdbuf()->pubsync();
-		return m_os.rdbuf()->pubsync();
+		return m_os ? m_os->rdbuf()->pubsync() : 0;
 	}
 
 	private:
-	ostream& m_os;
+	string& pending()
+	{
+		thread_local map<const logbuf*, string> lines;
+		return lines[this];
+	}
+
+	void write_line(string& line)
+	{
+		if (line.empty()) {
+			return;
+		}
+
+		lock_guard<recursive_mutex> lock(log_mutex);
+		file.rdbuf()->sputn(line.data(), line.size());
+		if (m_os) {
+			m_os->rdbuf()->sputn(line.data(), line.size());
+		}
+
+		line.clear();
+	}
+
+	ostream* m_os;
 };
 
 ofstream logbuf::file;
 
-ostream log_cout(new logbuf(cout));
-ostream log_cerr(new logbuf(cerr));
+ostream log_cout(new logbuf(&cout));
+ostream log_cerr(new logbuf(&cerr));
+ostream log_file(new logbuf(nullptr));
+string logfile_name;
 }
 
 string trim(string str)
@@ -133,6 +178,17 @@ string trim(string str)
 	return str;
 }
 
+string_view trim_view(string_view str)
+{
+	auto i = str.find_last_not_of(" \r\n\t");
+	if (i == string_view::npos) {
+		return string_view();
+	}
+
+	str = str.substr(0, i + 1);
+	return str.substr(str.find_first_not_of(" \r\n\t"));
+}
+
 vector<string> split(const string& str, char delim, bool empties, size_t limit)
 {
 	string::size_type beg = 0, end = str.find(delim);
@@ -197,6 +253,70 @@ string from_hex(const string& hexstr)
 	return ret;
 }
 
+void histogram::add(uint64_t value)
+{
+	unsigned i = 0;
+	for (uint64_t v = value; v; v >>= 1) {
+		++i;
+	}
+
+	++m_buckets[i];
+	++m_count;
+	m_sum += value;
+	m_min = min(m_min, value);
+	m_max = max(m_max, value);
+}
+
+void histogram::add(const histogram& other)
+{
+	for (unsigned i = 0; i < m_buckets.size(); ++i) {
+		m_buckets[i] += other.m_buckets[i];
+	}
+
+	m_count += other.m_count;
+	m_sum += other.m_sum;
+	m_min = min(m_min, other.m_min);
+	m_max = max(m_max, other.m_max);
+}
+
+uint64_t histogram::percentile(double p) const
+{
+	uint64_t n = 0;
+
+	for (unsigned i = 0; i < m_buckets.size(); ++i) {
+		n += m_buckets[i];
+		if (n && n >= p * m_count / 100) {
+			return min(m_max, i ? (uint64_t(1) << (i - 1)) * 2 - 1 : 0);
+		}
+	}
+
+	return m_max;
+}
+
+void histogram::to_json(ostream& os) const
+{
+	os << "{ \"count\": " << m_count << ", \"sum\": " << m_sum;
+
+	if (m_count) {
+		os << ", \"min\": " << m_min << ", \"max\": " << m_max << ", \"mean\": " << mean()
+				<< ", \"p50\": " << percentile(50) << ", \"p90\": " << percentile(90)
+				<< ", \"p99\": " << percentile(99);
+	}
+
+	// bucket counts, by (inclusive) upper bound
+	os << ", \"buckets\": {";
+
+	bool first = true;
+	for (unsigned i = 0; i < m_buckets.size(); ++i) {
+		if (m_buckets[i]) {
+			os << (first ? " " : ", ") << "\"" << (i ? (uint64_t(1) << (i - 1)) * 2 - 1 : 0) << "\": " << m_buckets[i];
+			first = false;
+		}
+	}
+
+	os << (first ? "} }" : " } }");
+}
+
 std::string transform(const std::string& str, std::function<int(int)> f)
 {
 	string ret;
@@ -238,7 +358,8 @@ constexpr int logger::err;
 ostream& logger::log(int severity)
 {
 	if (severity < s_loglevel) {
-		return logbuf::file;
+		// without a log file, this is a no-op
+		return logbuf::file.is_open() ? log_file : logbuf::file;
 	} else if (s_no_stdout || severity >= warn) {
 		return log_cerr;
 	} else {
@@ -254,25 +375,64 @@ void logger::log(int severity, const char* format, va_list args)
 
 	char buf[256];
 	vsnprintf(buf, sizeof(buf), format, args);
-	log(severity) << buf;
+	// these are often used for partial lines (e.g. progress output)
+	log(severity) << buf << flush;
 }
 
-void logger::log_io(const string& line, bool in)
+void logger::log_io(string_view line, bool in)
 {
+	lock_guard<recursive_mutex> lock(log_mutex);
+
 	if (s_lines.size() == 50) {
-		s_lines.pop_front();
+		// recycle the oldest line
+		s_lines.splice(s_lines.end(), s_lines, s_lines.begin());
+	} else {
+		s_lines.emplace_back();
 	}
 
-	s_lines.push_back((in ? "==> " : "<== ") + (line.empty() ?
-				"(empty)"s : ("'" + trim(line.c_str()) + "'")));
+	string& str = s_lines.back();
+	str = in ? "==> " : "<== ";
+
+	if (line.empty()) {
+		str += "(empty)";
+	} else {
+		line = trim_view(line.substr(0, line.find('\0')));
+		str += '\'';
+		str.append(line.data(), line.size());
+		str += '\'';
+	}
 
-	ostream& os = logbuf::file ? logbuf::file : log(trace);
+	ostream& os = logbuf::file.is_open() ? log_file : log(trace);
 	os << s_lines.back() << endl;
 }
 
+list<string> logger::get_last_io_lines()
+{
+	lock_guard<recursive_mutex> lock(log_mutex);
+	return s_lines;
+}
+
 void logger::set_logfile(const string& filename)
 {
-	logbuf::file.open(filename.c_str());
+	lock_guard<recursive_mutex> lock(log_mutex);
+
+	if (logbuf::file.is_open()) {
+		log_file.flush();
+		logbuf::file.close();
+	}
+
+	logbuf::file.clear();
+	logfile_name = filename;
+
+	if (!filename.empty()) {
+		logbuf::file.open(filename.c_str());
+	}
+}
+
+string logger::get_logfile()
+{
+	lock_guard<recursive_mutex> lock(log_mutex);
+	return logfile_name;
 }
 
 string getaddrinfo_category::message(int condition) const
@@ -20,6 +20,7 @@
 #ifndef BCM2UTILS_UTIL_H
 #define BCM2UTILS_UTIL_H
 #include <boost/endian/conversion.hpp>
+#include <boost/utility/string_view.hpp>
 #include <boost/crc.hpp>
 #include <system_error>
 #include <type_traits>
@@ -29,6 +30,7 @@
 #include <iostream>
 #include <iomanip>
 #include <fstream>
+#include <array>
 #include <sstream>
 #include <cstdarg>
 #include <chrono>
@@ -66,31 +68,26 @@
 namespace bcm2dump {
 
 typedef void (*sigh_type)(int);
+typedef boost::string_view string_view;
 
 std::string trim(std::string str);
+// like trim(), but returns a view into the original string
+string_view trim_view(string_view str);
 std::vector<std::string> split(const std::string& str, char delim, bool empties = true, size_t limit = 0);
 
-inline bool contains(const std::string& haystack, const std::string& needle)
+inline bool contains(string_view haystack, string_view needle)
 {
-	return haystack.find(needle) != std::string::npos;
+	return haystack.find(needle) != string_view::npos;
 }
 
-inline bool starts_with(const std::string& haystack, const std::string& needle)
+inline bool starts_with(string_view haystack, string_view needle)
 {
-	if (haystack.size() < needle.size()) {
-		return false;
-	} else {
-		return haystack.substr(0, needle.size()) == needle;
-	}
+	return haystack.starts_with(needle);
 }
 
-inline bool ends_with(const std::string& haystack, const std::string& needle)
+inline bool ends_with(string_view haystack, string_view needle)
 {
-	if (haystack.size() < needle.size()) {
-		return false;
-	} else {
-		return haystack.substr(haystack.size() - needle.size()) == needle;
-	}
+	return haystack.ends_with(needle);
 }
 
 template<class T> std::string to_buf(const T& t)
@@ -98,6 +95,11 @@ template<class T> std::string to_buf(const T& t)
 	return std::string(reinterpret_cast<const char*>(&t), sizeof(T));
 }
 
+template<class T> void append_buf(std::string& buf, const T& t)
+{
+	buf.append(reinterpret_cast<const char*>(&t), sizeof(T));
+}
+
 template<class T> T extract(const std::string& data, std::string::size_type offset = 0)
 {
 	return *reinterpret_cast<const T*>(data.substr(offset, sizeof(data)).c_str());
@@ -116,7 +118,7 @@ class bad_lexical_cast : public std::invalid_argument
 
 template<class T> T lexical_cast(const std::string& str, unsigned base = 10, bool all = true)
 {
-	static std::istringstream istr;
+	static thread_local std::istringstream istr;
 	istr.clear();
 	istr.str(str);
 	T t;
@@ -226,6 +228,12 @@ class mstimer
 			(now() - m_start).count();
 	}
 
+	auto elapsed_us() const
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>
+			(now() - m_start).count();
+	}
+
 	void reset()
 	{ m_start = now(); }
 	
@@ -238,6 +246,36 @@ class mstimer
 	tpt m_start;
 };
 
+// collects values into power-of-two buckets
+class histogram
+{
+	public:
+	void add(uint64_t value);
+	void add(const histogram& other);
+
+	uint64_t count() const
+	{ return m_count; }
+
+	uint64_t sum() const
+	{ return m_sum; }
+
+	double mean() const
+	{ return m_count ? double(m_sum) / m_count : 0; }
+
+	// returns an upper bound for the given percentile
+	uint64_t percentile(double p) const;
+
+	void to_json(std::ostream& os) const;
+
+	private:
+	uint64_t m_count = 0;
+	uint64_t m_sum = 0;
+	uint64_t m_min = UINT64_MAX;
+	uint64_t m_max = 0;
+	// bucket 0 counts zeroes, bucket n values in [2^(n-1), 2^n)
+	std::array<uint64_t, 65> m_buckets {};
+};
+
 std::string transform(const std::string& str, std::function<int(int)> f);
 
 std::string escape(std::string str, bool escape_quote = false);
@@ -336,7 +374,7 @@ class logger
 	static std::ostream& log(int severity);
 
 	static void log(int severity, const char* format, va_list args);
-	static void log_io(const std::string& line, bool in);
+	static void log_io(string_view line, bool in);
 
 	static std::ostream& t()
 	{ return log(trace); }
@@ -370,10 +408,11 @@ class logger
 	static void no_stdout(bool no_stdout = true)
 	{ s_no_stdout = no_stdout; }
 
+	// an empty filename closes the current logfile
 	static void set_logfile(const std::string& filename);
+	static std::string get_logfile();
 
-	static std::list<std::string> get_last_io_lines()
-	{ return s_lines; }
+	static std::list<std::string> get_last_io_lines();
 
 	private:
 	static std::list<std::string> s_lines;